@@ -86,7 +86,30 @@ WORD CATADevice::In (WORD wPort_)
                         }
 
                         if (!m_uBuffer)
+                        {
                             TRACE("ATA: All data read\n");
+
+                            // Multi-sector read?
+                            if ((m_sRegs.bCommand == 0x20 || m_sRegs.bCommand == 0x21 || m_sRegs.bCommand == 0xc4) && --m_sRegs.bSectorCount)
+                            {
+                                TRACE(" %d sectors left in multi-sector read...\n", m_sRegs.bSectorCount);
+
+                                // Next sector
+                                NextSector();
+
+                                if (!ReadWriteSector(false))
+                                {
+                                    m_sRegs.bStatus |= ATA_STATUS_ERROR;
+                                    m_sRegs.bError = ATA_ERROR_UNC;
+                                }
+                                else
+                                {
+                                    // Set the sector buffer pointer and how much we have available to read
+                                    m_pbBuffer = m_abSectorData;
+                                    m_uBuffer = sizeof(m_abSectorData);
+                                }
+                            }
+                        }
                     }
 
                     // Return the data register
@@ -216,26 +239,7 @@ void CATADevice::Out (WORD wPort_, WORD wVal_)
                                         TRACE(" %d sectors left in multi-sector write...\n", m_sRegs.bSectorCount);
 
                                         // Next sector
-                                        if (++m_sRegs.bSector > m_sGeometry.uSectors)
-                                        {
-                                            m_sRegs.bSector = 1;
-
-                                            // Are the head bits just below max value?
-                                            if ((m_sRegs.bDeviceHead & ATA_HEAD_MASK) == m_sGeometry.uHeads-1)
-                                            {
-                                                // Head bits back to zero
-                                                m_sRegs.bDeviceHead &= ~ATA_HEAD_MASK;
-
-                                                // Next cylinder
-                                                if (!++m_sRegs.bCylinderLow)
-                                                    m_sRegs.bCylinderHigh++;
-                                            }
-                                            else
-                                            {
-                                                // Next head
-                                                m_sRegs.bDeviceHead++;
-                                            }
-                                        }
+                                        NextSector();
 
                                         // Set the sector buffer pointer and how much we have available to read
                                         m_pbBuffer = m_abSectorData;
@@ -307,6 +311,11 @@ void CATADevice::Out (WORD wPort_, WORD wVal_)
                         {
                             TRACE("ATA: Disk command: Read Sectors\n");
 
+                            // Give the device a chance to fetch the whole transfer in one go
+                            UINT uSector;
+                            if ((bVal & ~1) != 0x40 && GetSectorNumber(&uSector))
+                                PrefetchSectors(uSector, m_sRegs.bSectorCount ? m_sRegs.bSectorCount : 256);
+
                             if (!ReadWriteSector(false))
                             {
                                 m_sRegs.bStatus |= ATA_STATUS_ERROR;
@@ -458,21 +467,20 @@ void CATADevice::Out (WORD wPort_, WORD wVal_)
 }
 
 
-bool CATADevice::ReadWriteSector (bool fWrite_)
+// Determine the logical block number for the current register position
+bool CATADevice::GetSectorNumber (UINT* puSector_)
 {
-    UINT uSector = 0;
-
     // LBA request?
     if (m_sRegs.bDeviceHead & 0x40)
     {
         // Form the 28-bit LBA address
-        uSector = ((m_sRegs.bDeviceHead & 0x0f) << 24) | (m_sRegs.bCylinderHigh << 16) | (m_sRegs.bCylinderLow << 8) | m_sRegs.bSector;
+        *puSector_ = ((m_sRegs.bDeviceHead & 0x0f) << 24) | (m_sRegs.bCylinderHigh << 16) | (m_sRegs.bCylinderLow << 8) | m_sRegs.bSector;
 
         // Fail if the location is outside the disk geometry
-        if (uSector >= m_sGeometry.uTotalSectors)
+        if (*puSector_ >= m_sGeometry.uTotalSectors)
             return false;
 
-        TRACE("%s LBA=%u\n", fWrite_ ? "Writing" : "Reading", uSector);
+        TRACE("LBA=%u\n", *puSector_);
     }
     else // CHS request
     {
@@ -486,10 +494,51 @@ bool CATADevice::ReadWriteSector (bool fWrite_)
             return false;
 
         // Calculate the logical block number from the CHS position
-        uSector = (wCylinder * m_sGeometry.uHeads + bHead) * m_sGeometry.uSectors + (bSector - 1);
-        TRACE("%s CHS %u:%u:%u  [LBA=%u]\n", fWrite_ ? "Writing" : "Reading", wCylinder, bHead, bSector, uSector);
+        *puSector_ = (wCylinder * m_sGeometry.uHeads + bHead) * m_sGeometry.uSectors + (bSector - 1);
+        TRACE("CHS %u:%u:%u  [LBA=%u]\n", wCylinder, bHead, bSector, *puSector_);
     }
 
+    return true;
+}
+
+// Advance the registers to the next sector of a multi-sector transfer
+void CATADevice::NextSector ()
+{
+    // LBA mode steps the 28-bit address spread across the registers
+    if (m_sRegs.bDeviceHead & 0x40)
+    {
+        if (!++m_sRegs.bSector && !++m_sRegs.bCylinderLow && !++m_sRegs.bCylinderHigh)
+            m_sRegs.bDeviceHead = (m_sRegs.bDeviceHead & ~ATA_HEAD_MASK) | ((m_sRegs.bDeviceHead + 1) & ATA_HEAD_MASK);
+    }
+    else if (++m_sRegs.bSector > m_sGeometry.uSectors)
+    {
+        m_sRegs.bSector = 1;
+
+        // Are the head bits just below max value?
+        if ((m_sRegs.bDeviceHead & ATA_HEAD_MASK) == m_sGeometry.uHeads-1)
+        {
+            // Head bits back to zero
+            m_sRegs.bDeviceHead &= ~ATA_HEAD_MASK;
+
+            // Next cylinder
+            if (!++m_sRegs.bCylinderLow)
+                m_sRegs.bCylinderHigh++;
+        }
+        else
+        {
+            // Next head
+            m_sRegs.bDeviceHead++;
+        }
+    }
+}
+
+bool CATADevice::ReadWriteSector (bool fWrite_)
+{
+    UINT uSector = 0;
+
+    if (!GetSectorNumber(&uSector))
+        return false;
+
     if (fWrite_)
         return WriteSector(uSector, m_abSectorData);
 
@@ -125,8 +125,12 @@ class CATADevice
     public:
         virtual bool ReadSector (UINT uSector_, BYTE* pb_) = 0;
         virtual bool WriteSector (UINT uSector_, BYTE* pb_) = 0;
+        virtual void PrefetchSectors (UINT /*uSector_*/, UINT /*uCount_*/) { }
+        virtual void FrameEnd () { }
 
     protected:
+        bool GetSectorNumber (UINT* puSector_);
+        void NextSector ();
         bool ReadWriteSector (bool fWrite_);
         void SetIdentifyData (IDENTIFYDEVICE *pid_);
 
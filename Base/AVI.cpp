@@ -214,7 +214,7 @@ static bool WriteAudioHeader (FILE *f_)
     long lPos = WriteChunkStart(f_, "strh", "auds");
 
     // Default to normal sound parameters
-    WORD wFreq = SAMPLE_FREQ;
+    DWORD dwFreq = Sound::GetSampleFreq();
     WORD wBits = SAMPLE_BITS;
     WORD wBlock = SAMPLE_BLOCK;
     WORD wChannels = SAMPLE_CHANNELS;
@@ -225,7 +225,7 @@ static bool WriteAudioHeader (FILE *f_)
 
     // 22kHz?
     if (nAudioReduce >= 2)
-        wFreq /= 2;
+        dwFreq /= 2;
 
     // Mono?
     if (nAudioReduce >= 3)
@@ -237,7 +237,7 @@ static bool WriteAudioHeader (FILE *f_)
     WriteLittleEndianDWORD(0);				// priority and language, unused
     WriteLittleEndianDWORD(1);				// initial frames
     WriteLittleEndianDWORD(wBlock);			// scale
-    WriteLittleEndianDWORD(wFreq*wBlock);	// rate
+    WriteLittleEndianDWORD(dwFreq*wBlock);	// rate
     WriteLittleEndianDWORD(0);				// start time
     WriteLittleEndianDWORD(dwAudioSamples);	// total samples in stream
     WriteLittleEndianDWORD(lAudioMax);		// suggested buffer size
@@ -252,8 +252,8 @@ static bool WriteAudioHeader (FILE *f_)
 
     WriteLittleEndianWORD(1);				// format tag (1 = WAVE_FORMAT_PCM)
     WriteLittleEndianWORD(wChannels);		// channels
-    WriteLittleEndianDWORD(wFreq);			// samples per second
-    WriteLittleEndianDWORD(wFreq*wBlock);	// average bytes per second
+    WriteLittleEndianDWORD(dwFreq);			// samples per second
+    WriteLittleEndianDWORD(dwFreq*wBlock);	// average bytes per second
     WriteLittleEndianWORD(wBlock);			// block align
     WriteLittleEndianWORD(wBits);			// bits per sample
     WriteLittleEndianWORD(0);				// extra structure size
@@ -482,7 +482,7 @@ bool Start (bool fHalfSize_)
     // Set scanline mode for the recording (low-res only)
     fScanlines = GetOption(scanlines) && !GetOption(scanhires) && GetOption(aviscanlines);
 
-#if SAMPLE_FREQ == 44100 && SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
+#if SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
     // Set the audio reduction level
     nAudioReduce = GetOption(avireduce);
 #endif
@@ -21,6 +21,7 @@
 #include "SimCoupe.h"
 #include "Action.h"
 
+#include "AtaAdapter.h"
 #include "AVI.h"
 #include "CPU.h"
 #include "Debug.h"
@@ -49,10 +50,46 @@ const char* aszActions[MAX_ACTION] =
     "Toggle Smoothing", "Toggle scanlines", "Toggle greyscale", "Mute sound", "Release mouse capture",
     "Toggle printer online", "Flush printer", "About SimCoupe", "Minimise window", "Record GIF animation", "Record GIF loop",
     "Stop GIF Recording", "Record WAV audio", "Record WAV segment", "Stop WAV Recording", "Record AVI video", "Record AVI half-size", "Stop AVI Recording",
-    "Speed Faster", "Speed Slower", "Speed Normal", "Paste Clipboard", "Insert Tape", "Eject Tape", "Tape Browser"
+    "Speed Faster", "Speed Slower", "Speed Normal", "Paste Clipboard", "Insert Tape", "Eject Tape", "Tape Browser",
+    "Commit disk overlays", "Discard disk overlays"
 };
 
 
+// Commit or discard the overlay changes of all disks using them
+static void UpdateOverlays (bool fCommit_)
+{
+    CDiskDevice* apDrives[] = { pFloppy1, pFloppy2 };
+    CAtaAdapter* apAdapters[] = { pAtom, pAtomLite, pSDIDE };
+    int nOverlays = 0;
+    bool fRet = true;
+
+    for (auto pDrive : apDrives)
+    {
+        if (pDrive->HasOverlay())
+        {
+            fRet &= fCommit_ ? pDrive->CommitOverlay() : pDrive->DiscardOverlay();
+            nOverlays++;
+        }
+    }
+
+    for (auto pAdapter : apAdapters)
+    {
+        if (pAdapter->HasOverlay())
+        {
+            fRet &= fCommit_ ? pAdapter->CommitOverlay() : pAdapter->DiscardOverlay();
+            nOverlays++;
+        }
+    }
+
+    if (!nOverlays)
+        Frame::SetStatus("No disk overlays in use");
+    else if (!fRet)
+        Message(msgError, "Failed to %s disk overlay changes", fCommit_ ? "commit" : "discard");
+    else
+        Frame::SetStatus("Disk overlay changes %s", fCommit_ ? "committed" : "discarded");
+}
+
+
 bool Do (int nAction_, bool fPressed_/*=true*/)
 {
     // OS-specific functionality takes precedence
@@ -184,6 +221,14 @@ bool Do (int nAction_, bool fPressed_/*=true*/)
                 Frame::SaveScreenshot();
                 break;
 
+            case actCommitOverlays:
+                UpdateOverlays(true);
+                break;
+
+            case actDiscardOverlays:
+                UpdateOverlays(false);
+                break;
+
             case actDebugger:
                 if (!GUI::IsActive())
                     Debug::Start();
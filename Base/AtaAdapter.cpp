@@ -54,6 +54,16 @@ void CAtaAdapter::Out (WORD wPort_, BYTE bVal_)
 }
 
 
+void CAtaAdapter::FrameEnd ()
+{
+    if (m_uActive)
+        m_uActive--;
+
+    // Let the disks flush any cached writes when idle
+    if (m_pDisk0) m_pDisk0->FrameEnd();
+    if (m_pDisk1) m_pDisk1->FrameEnd();
+}
+
 void CAtaAdapter::Reset ()
 {
     if (m_pDisk0) m_pDisk0->Reset();
@@ -94,3 +104,30 @@ void CAtaAdapter::Detach ()
     delete m_pDisk0, m_pDisk0 = nullptr;
     delete m_pDisk1, m_pDisk1 = nullptr;
 }
+
+
+bool CAtaAdapter::HasOverlay () const
+{
+    return (m_pDisk0 && m_pDisk0->HasOverlay()) || (m_pDisk1 && m_pDisk1->HasOverlay());
+}
+
+// Write overlay changes to the disk images, returning false if any failed
+bool CAtaAdapter::CommitOverlay ()
+{
+    bool fRet = true;
+
+    if (m_pDisk0 && m_pDisk0->HasOverlay()) fRet &= m_pDisk0->CommitOverlay();
+    if (m_pDisk1 && m_pDisk1->HasOverlay()) fRet &= m_pDisk1->CommitOverlay();
+
+    return fRet;
+}
+
+bool CAtaAdapter::DiscardOverlay ()
+{
+    bool fRet = true;
+
+    if (m_pDisk0 && m_pDisk0->HasOverlay()) fRet &= m_pDisk0->DiscardOverlay();
+    if (m_pDisk1 && m_pDisk1->HasOverlay()) fRet &= m_pDisk1->DiscardOverlay();
+
+    return fRet;
+}
@@ -36,11 +36,15 @@ class CAtaAdapter : public CIoDevice
         void Out (WORD wPort_, BYTE bVal_) override;
 
         void Reset () override;
-        void FrameEnd () override { if (m_uActive) m_uActive--; }
+        void FrameEnd () override;
 
     public:
         bool IsActive () const { return m_uActive != 0; }
 
+        bool HasOverlay () const;
+        bool CommitOverlay ();
+        bool DiscardOverlay ();
+
     public:
         bool Attach (const char *pcszDisk_, int nDevice_);
         virtual bool Attach (CHardDisk *pDisk_, int nDevice_);
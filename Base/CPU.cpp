@@ -42,6 +42,7 @@
 #include "Memory.h"
 #include "Mouse.h"
 #include "Options.h"
+#include "Sound.h"
 #include "Tape.h"
 #include "UI.h"
 #include "Util.h"
@@ -469,8 +470,9 @@ void Run ()
 
 void Reset (bool fPress_)
 {
-    // Set CPU operating mode
+    // Set CPU operating mode, and let the sound chips know when their clock stops or starts
     g_fReset = fPress_;
+    Sound::SetReset(fPress_);
 
     if (g_fReset)
     {
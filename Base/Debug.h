@@ -52,7 +52,7 @@ class CView : public CWindow
         bool OnMessage (int /*nMessage_*/, int /*nParam1_*/, int /*nParam2_*/) override { return false; }
 
         WORD GetAddress () const { return m_wAddr; }
-        virtual void SetAddress (WORD wAddr_, bool /*fForceTop_*/=false) { m_wAddr = wAddr_; }
+        virtual void SetAddress (WORD wAddr_, bool /*fForceTop_*/=false) { m_wAddr = wAddr_; Invalidate(); }
         virtual bool cmdNavigate (int nKey_, int nMods_) = 0;
 
     private:
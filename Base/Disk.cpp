@@ -20,14 +20,143 @@
 
 // Notes:
 //  The CFloppyDisk implementation is OS-specific, and is in Floppy.cpp
+//
+//  Image files are saved by a background writer thread, from snapshots of
+//  the changed data taken at save time. Where the stream supports it only
+//  the dirty tracks are updated in place, otherwise the whole image is
+//  rewritten via a temporary file.
+//
+//  If the stream is memory-mapped the image is used directly from its
+//  private mapping, and saving writes snapshots of the dirty tracks to the
+//  file in the same way.
 
 #include "SimCoupe.h"
 #include "Disk.h"
 
 #include "Drive.h"
 #include "Floppy.h"
+#include "Overlay.h"
 #include "Util.h"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    CStream *pStream;       // Stream to write to
+    size_t uOffset, uLen;   // Region to update, or the full image size for a rewrite
+    BYTE *pbData;           // Snapshot of the data to write, owned by the writer
+    bool fRewrite;          // Replace the whole stream, rather than updating in place?
+    bool fRelease;          // Delete the stream, now its disk has gone?
+    UINT uTrack, uTracks;   // Dirty tracks being written, to restore if the write fails
+}
+DISK_WRITE;
+
+static std::deque<DISK_WRITE> dWrites;      // Pending writes, in the order they were queued
+static std::deque<DISK_WRITE> dFailed;      // Failed writes, for their disks to pick up
+static std::mutex mWrites;
+static std::condition_variable cvWritten;
+static std::thread *pWriter;
+static bool fWriterRunning;
+
+static bool fWriteFailed;                   // Failure to report from the main thread
+static char szFailedFile[MAX_PATH];
+
+
+// Forget failed writes to a stream that's going away, as nothing can pick them up
+static void DropFailedWrites (const CStream* pStream_)
+{
+    dFailed.erase(std::remove_if(dFailed.begin(), dFailed.end(), [=] (const DISK_WRITE &w) {
+        return w.pStream == pStream_;
+    }), dFailed.end());
+}
+
+// The writer owns a queued stream until its writes are done, so the disk must wait before using it
+static void WriterProc ()
+{
+    std::unique_lock<std::mutex> lock(mWrites);
+
+    while (!dWrites.empty())
+    {
+        DISK_WRITE w = dWrites.front();
+
+        // Streams are released after their last write, so there's nothing to wait for
+        if (w.fRelease)
+        {
+            dWrites.pop_front();
+            lock.unlock();
+            delete w.pStream;
+            lock.lock();
+
+            DropFailedWrites(w.pStream);
+            cvWritten.notify_all();
+            continue;
+        }
+
+        // Leave the write queued while we work on it, so waiters know it's not done
+        lock.unlock();
+
+        bool fWritten;
+        if (w.fRewrite)
+            fWritten = w.pStream->Rewrite(w.pbData, w.uLen);
+        else
+            fWritten = w.pStream->WriteAt(w.uOffset, w.pbData, w.uLen);
+
+        w.pStream->Close();
+        delete[] w.pbData;
+
+        lock.lock();
+        dWrites.pop_front();
+
+        if (!fWritten)
+        {
+            strncpy(szFailedFile, w.pStream->GetFile(), sizeof(szFailedFile)-1);
+            fWriteFailed = true;
+
+            w.pbData = nullptr;
+            dFailed.push_back(w);
+        }
+
+        cvWritten.notify_all();
+    }
+
+    fWriterRunning = false;
+}
+
+static void QueueWrite (const DISK_WRITE &w_)
+{
+    std::lock_guard<std::mutex> lock(mWrites);
+    dWrites.push_back(w_);
+
+    // Start the writer if it's idle, tidying up after any previous run
+    if (!fWriterRunning)
+    {
+        if (pWriter)
+        {
+            pWriter->join();
+            delete pWriter;
+        }
+
+        pWriter = new std::thread(WriterProc);
+        fWriterRunning = true;
+    }
+}
+
+// Wait for pending writes to the given path, or all writes if none is given
+static void WaitWrites (const char* pcszPath_)
+{
+    std::unique_lock<std::mutex> lock(mWrites);
+
+    cvWritten.wait(lock, [=] {
+        return std::none_of(dWrites.begin(), dWrites.end(), [=] (const DISK_WRITE &w) {
+            return !pcszPath_ || !strcmp(w.pStream->GetPath(), pcszPath_);
+        });
+    });
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 /*static*/ int CDisk::GetType (CStream* pStream_)
@@ -62,8 +191,16 @@
 {
     CDisk* pDisk = nullptr;
 
-    // Fetch stream for the disk source
-    CStream* pStream = CStream::Open(pcszDisk_, fReadOnly_);
+    // Make sure any changes still being written are included
+    if (pcszDisk_)
+        ::WaitWrites(pcszDisk_);
+
+    // Fetch stream for the disk source, with changes going to an overlay if enabled
+    CStream* pStream;
+    if (!fReadOnly_ && COverlay::IsEnabled() && pcszDisk_ && !CFloppyStream::IsRecognised(pcszDisk_))
+        pStream = COverlayStream::Open(pcszDisk_);
+    else
+        pStream = CStream::Open(pcszDisk_, fReadOnly_);
 
     // A disk will only be returned if the stream format is recognised
     if (pStream)
@@ -93,16 +230,157 @@
 }
 
 
+// Wait for all background writes to complete, such as before exiting
+/*static*/ void CDisk::WaitWrites ()
+{
+    ::WaitWrites(nullptr);
+
+    std::lock_guard<std::mutex> lock(mWrites);
+    if (pWriter && !fWriterRunning)
+    {
+        pWriter->join();
+        delete pWriter, pWriter = nullptr;
+    }
+}
+
+// Fetch the name of an image that failed to save, if any, clearing the error
+/*static*/ bool CDisk::GetWriteError (char* pszFile_, size_t uLen_)
+{
+    std::lock_guard<std::mutex> lock(mWrites);
+
+    if (!fWriteFailed)
+        return false;
+
+    strncpy(pszFile_, szFailedFile, uLen_-1);
+    pszFile_[uLen_-1] = '\0';
+    fWriteFailed = false;
+
+    return true;
+}
+
+
 CDisk::CDisk (CStream* pStream_, int nType_)
-    : m_nType(nType_), m_nBusy(0), m_fModified(false), m_pStream(pStream_), m_pbData(nullptr)
+    : m_nType(nType_), m_nBusy(0), m_fModified(false), m_fRewrite(!pStream_->IsOpen()), m_fMapped(false), m_fWriteFailed(false), m_pStream(pStream_), m_pbData(nullptr)
 {
+    memset(m_afDirty, 0, sizeof(m_afDirty));
 }
 
 CDisk::~CDisk ()
 {
-    // Delete the stream object and disk data memory we allocated
-    delete m_pStream;
-    delete[] m_pbData;
+    std::unique_lock<std::mutex> lock(mWrites);
+
+    // Leave the stream to the writer if it's still busy, as it may have changes to write
+    if (fWriterRunning)
+        dWrites.push_back({ m_pStream, 0, 0, nullptr, false, true, 0, 0 });
+    else
+    {
+        DropFailedWrites(m_pStream);
+        lock.unlock();
+        delete m_pStream;
+    }
+
+    if (!m_fMapped)
+        delete[] m_pbData;
+}
+
+void CDisk::Close ()
+{
+    // The stream belongs to the writer until our changes are written
+    ::WaitWrites(GetPath());
+    m_pStream->Close();
+}
+
+bool CDisk::CommitOverlay ()
+{
+    ::WaitWrites(GetPath());
+    return m_pStream->CommitOverlay();
+}
+
+bool CDisk::DiscardOverlay ()
+{
+    ::WaitWrites(GetPath());
+    return m_pStream->DiscardOverlay();
+}
+
+// Restore the dirty state of changes that failed to save in the background, returning false if there were any
+bool CDisk::CheckWrites ()
+{
+    std::lock_guard<std::mutex> lock(mWrites);
+    bool fRet = true;
+
+    for (auto it = dFailed.begin() ; it != dFailed.end() ; )
+    {
+        if (it->pStream != m_pStream)
+        {
+            ++it;
+            continue;
+        }
+
+        if (it->fRewrite)
+            SetRewrite();
+        else
+        {
+            for (UINT u = it->uTrack ; u < it->uTrack + it->uTracks ; u++)
+                SetDirty(u);
+        }
+
+        it = dFailed.erase(it);
+        m_fWriteFailed = true;
+        fRet = false;
+    }
+
+    return fRet;
+}
+
+// Queue a snapshot of image data to be written in the background, noting the dirty tracks it covers
+void CDisk::QueueWrite (size_t uOffset_, const void* pv_, size_t uLen_, bool fRewrite_, UINT uTrack_/*=0*/, UINT uTracks_/*=0*/)
+{
+    DISK_WRITE w = { m_pStream, uOffset_, uLen_, new BYTE[uLen_], fRewrite_, false, uTrack_, uTracks_ };
+    memcpy(w.pbData, pv_, uLen_);
+
+    ::QueueWrite(w);
+}
+
+// Start saving changes, returning false if earlier changes failed to save (they're included again)
+bool CDisk::BeginSave ()
+{
+    CheckWrites();
+
+    bool fRet = !m_fWriteFailed;
+    m_fWriteFailed = false;
+    return fRet;
+}
+
+// Save a contiguous image of fixed-size tracks, writing only the dirty tracks if possible
+bool CDisk::SaveImage (size_t uTrackBase_, size_t uTrackSize_, UINT uTracks_, size_t uImageSize_)
+{
+    bool fRet = BeginSave();
+
+    if (!m_fMapped && (m_fRewrite || !m_pStream->CanWriteAt()))
+        QueueWrite(0, m_pbData, uImageSize_, true);
+    else
+    {
+        // Write each run of dirty tracks as a single block
+        for (UINT u = 0, uEnd ; u < uTracks_ ; u = uEnd)
+        {
+            for (uEnd = u ; uEnd < uTracks_ && m_afDirty[uEnd] ; uEnd++);
+
+            if (uEnd == u)
+                uEnd++;
+            else
+            {
+                size_t uOffset = uTrackBase_ + u*uTrackSize_;
+                QueueWrite(uOffset, m_pbData + uOffset, (uEnd-u)*uTrackSize_, false, u, uEnd-u);
+            }
+        }
+    }
+
+    // The writer restores the dirty state if it fails
+    memset(m_afDirty, 0, sizeof(m_afDirty));
+    m_fRewrite = false;
+    SetModified(false);
+
+    return fRet;
 }
 
 
@@ -142,6 +420,16 @@ bool CDisk::GetSector (BYTE cyl_, BYTE head_, BYTE index_, IDFIELD* pID_/*=nullp
 CMGTDisk::CMGTDisk (CStream* pStream_, UINT uSectors_/*=NORMAL_DISK_SECTORS*/)
     : CDisk(pStream_, dtMGT)
 {
+    size_t uSize = pStream_->GetSize();
+
+    // Use a mapped image in place
+    if ((m_pbData = pStream_->GetMapping()) && (uSize == MGT_IMAGE_SIZE || uSize == DOS_IMAGE_SIZE))
+    {
+        m_uSectors = (uSize == DOS_IMAGE_SIZE) ? DOS_DISK_SECTORS : NORMAL_DISK_SECTORS;
+        m_fMapped = true;
+        return;
+    }
+
     // Allocate some memory and clear it, just in case it's not a complete MGT image
     m_pbData = new BYTE[MGT_IMAGE_SIZE];
     memset(m_pbData, (uSectors_ == NORMAL_DISK_SECTORS) ? 0x00 : 0xe5, MGT_IMAGE_SIZE);
@@ -204,27 +492,19 @@ BYTE CMGTDisk::WriteData (BYTE cyl_, BYTE head_, BYTE index_, BYTE *pbData_, UIN
     long lPos = head_ + NORMAL_DISK_SIDES * cyl_;
     lPos = lPos * (m_uSectors * NORMAL_SECTOR_SIZE) + (index_ * NORMAL_SECTOR_SIZE);
 
-    // Copy the sector data to the image buffer, and set the modified flag
+    // Copy the sector data to the image buffer, and mark the track as changed
     memcpy(m_pbData + lPos, pbData_, *puSize_ = NORMAL_SECTOR_SIZE);
-    SetModified();
+    SetDirty(head_ + NORMAL_DISK_SIDES*cyl_);
 
     // Data is always perfect on MGT images, so return OK
     return 0;
 }
 
-// Save the disk out to the stream
+// Save the disk changes out to the stream
 bool CMGTDisk::Save ()
 {
-    size_t uSize = NORMAL_DISK_SIDES*NORMAL_DISK_TRACKS*m_uSectors*NORMAL_SECTOR_SIZE;
-
-    // Write the image out as a single block
-    if (!m_pStream->Rewind() || m_pStream->Write(m_pbData, uSize) != uSize)
-        return false;
-
-    m_pStream->Close();
-    SetModified(false);
-
-    return true;
+    UINT uTrackSize = m_uSectors*NORMAL_SECTOR_SIZE;
+    return SaveImage(0, uTrackSize, NORMAL_DISK_SIDES*NORMAL_DISK_TRACKS, NORMAL_DISK_SIDES*NORMAL_DISK_TRACKS*uTrackSize);
 }
 
 // Format a track using the specified format
@@ -265,7 +545,7 @@ BYTE CMGTDisk::FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDat
     for (u = 0 ; u < uSectors_ ; u++)
         memcpy(m_pbData + lPos + ((paID_[u].bSector-1) * NORMAL_SECTOR_SIZE), papbData_[u], NORMAL_SECTOR_SIZE);
 
-    SetModified();
+    SetDirty(head_ + NORMAL_DISK_SIDES*cyl_);
     return 0;
 }
 
@@ -276,7 +556,7 @@ BYTE CMGTDisk::FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDat
 	SAD_HEADER sh {};
 
     // Read the header, check for the signature, and make sure the disk geometry is sensible
-    bool fValid = (pStream_->Rewind() && pStream_->Read(&sh, sizeof(sh)) == sizeof(sh) &&
+    bool fValid = (pStream_->ReadAt(0, &sh, sizeof(sh)) == sizeof(sh) &&
             !memcmp(sh.abSignature, SAD_SIGNATURE, sizeof(sh.abSignature)) &&
             sh.bSides && sh.bSides <= MAX_DISK_SIDES && sh.bTracks && sh.bTracks <= 127 &&
             sh.bSectorSizeDiv64 && (sh.bSectorSizeDiv64 <= (MAX_SECTOR_SIZE >> 6)) &&
@@ -316,6 +596,14 @@ CSADDisk::CSADDisk (CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UINT
     m_uSectorSize = sh.bSectorSizeDiv64 << 6;
 
     UINT uDiskSize = sizeof(sh) + m_uSides * m_uTracks * m_uSectors * m_uSectorSize;
+
+    // Use a mapped image in place, if it's complete
+    if ((m_pbData = pStream_->GetMapping()) && pStream_->GetSize() == uDiskSize)
+    {
+        m_fMapped = true;
+        return;
+    }
+
     memcpy(m_pbData = new BYTE[uDiskSize], &sh, sizeof(sh));
     memset(m_pbData + sizeof(sh), 0, uDiskSize - sizeof(sh));
 
@@ -364,25 +652,19 @@ BYTE CSADDisk::WriteData (BYTE cyl_, BYTE head_, BYTE index_, BYTE *pbData_, UIN
     // Work out the offset for the required data
     long lPos = sizeof(SAD_HEADER) + (head_ * m_uTracks + cyl_) * (m_uSectors * m_uSectorSize) + (index_ * m_uSectorSize);
 
-    // Copy the sector data to the image buffer, and set the modified flag
+    // Copy the sector data to the image buffer, and mark the track as changed
     memcpy(m_pbData + lPos, pbData_, *puSize_ = m_uSectorSize);
-    SetModified();
+    SetDirty(head_ * m_uTracks + cyl_);
 
     // Data is always perfect on SAD images, so return OK
     return 0;
 }
 
-// Save the disk out to the stream
+// Save the disk changes out to the stream
 bool CSADDisk::Save ()
 {
-    UINT uDiskSize = sizeof(SAD_HEADER) + m_uSides * m_uTracks * m_uSectors * m_uSectorSize;
-
-    if (!m_pStream->Rewind() || m_pStream->Write(m_pbData, uDiskSize) != uDiskSize)
-        return false;
-
-    SetModified(false);
-    m_pStream->Close();
-    return true;
+    UINT uTrackSize = m_uSectors * m_uSectorSize;
+    return SaveImage(sizeof(SAD_HEADER), uTrackSize, m_uSides * m_uTracks, sizeof(SAD_HEADER) + m_uSides * m_uTracks * uTrackSize);
 }
 
 // Format a track using the specified format
@@ -417,14 +699,14 @@ BYTE CSADDisk::FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDat
         return WRITE_PROTECT;
 
     // Work out the offset for the required track
-    long lPos = sizeof(SAD_HEADER) + (head_ * m_uTracks + cyl_) * (m_uSectors * NORMAL_SECTOR_SIZE);
+    long lPos = sizeof(SAD_HEADER) + (head_ * m_uTracks + cyl_) * (m_uSectors * m_uSectorSize);
 
     // Process each sector to write the supplied data
     for (u = 0 ; u < uSectors_ ; u++)
         memcpy(m_pbData + lPos + ((paID_[u].bSector-1) * m_uSectorSize), papbData_[u], m_uSectorSize);
 
-    // Mark the disk stream as modified
-    SetModified();
+    // Mark the track as changed
+    SetDirty(head_ * m_uTracks + cyl_);
 
     return 0;
 }
@@ -435,7 +717,7 @@ BYTE CSADDisk::FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDat
     EDSK_HEADER eh;
 
     // Read the header, check the signature and basic geometry
-    bool fValid = (pStream_->Rewind() && pStream_->Read(&eh, sizeof(eh)) == sizeof(eh) &&
+    bool fValid = (pStream_->ReadAt(0, &eh, sizeof(eh)) == sizeof(eh) &&
             (!memcmp(eh.szSignature, EDSK_SIGNATURE, sizeof(EDSK_SIGNATURE)-1) ||
              !memcmp(eh.szSignature,  DSK_SIGNATURE, sizeof( DSK_SIGNATURE)-1)) &&
              eh.bSides >= 1 && eh.bSides <= MAX_DISK_SIDES);
@@ -470,6 +752,14 @@ CEDSKDisk::CEDSKDisk (CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UIN
     bool fEDSK = peh->szSignature[0] == EDSK_SIGNATURE[0];
     WORD wDSKTrackSize = peh->abTrackSize[0] | (peh->abTrackSize[1] << 8);  // DSK only
 
+    // Tracks can only be updated in place if we'll save the same layout as we loaded
+    m_fRewrite = !fEDSK || peh->bTracks > MAX_DISK_TRACKS;
+
+    // Use the tracks from a mapped image in place, if the layout allows it
+    BYTE *pbMap = m_fRewrite ? nullptr : pStream_->GetMapping();
+    size_t uOffset = sizeof(ab), uMapSize = pStream_->GetSize();
+    m_fMapped = pbMap != nullptr;
+
     for (BYTE cyl = 0 ; cyl < m_uTracks ; cyl++)
     {
         for (BYTE head = 0 ; head < m_uSides ; head++)
@@ -479,15 +769,19 @@ CEDSKDisk::CEDSKDisk (CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UIN
             if (!size)
                 continue;
 
-            BYTE *pb = new BYTE[size];
+            BYTE *pb = pbMap ? ((uOffset + size <= uMapSize) ? pbMap + uOffset : nullptr) : new BYTE[size];
             EDSK_TRACK* pt = reinterpret_cast<EDSK_TRACK*>(pb);
+            uOffset += size;
 
             // Read the track, rejecting anything but 250Kbps MFM
-            if (pt && (pStream_->Read(pt, size) != size || (pt->bRate && pt->bRate != 1) || (pt->bEncoding && pt->bEncoding != 1)))
+            if (!pt || (!pbMap && pStream_->Read(pt, size) != size) || (pt->bRate && pt->bRate != 1) || (pt->bEncoding && pt->bEncoding != 1))
             {
-                delete[] pb;
+                if (!pbMap)
+                    delete[] pb;
+
                 pt = nullptr;
                 size = 0;
+                m_fRewrite = true;
             }
 
             // Save the track (or nullptr) and size MSB
@@ -496,15 +790,42 @@ CEDSKDisk::CEDSKDisk (CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UIN
         }
     }
 
+    // Switch to our own copy if the layout will change when saved
+    if (m_fMapped && m_fRewrite)
+        Detach();
+
     pStream_->Close();
 }
 
 CEDSKDisk::~CEDSKDisk ()
 {
     // Free any allocated tracks
+    if (!m_fMapped)
+    {
+        for (BYTE cyl = 0 ; cyl < m_uTracks ; cyl++)
+            for (BYTE head = 0 ; head < m_uSides ; head++)
+                delete[] m_apTracks[head][cyl];
+    }
+}
+
+// Copy the tracks out of the stream mapping, ready for changes to the image layout
+void CEDSKDisk::Detach ()
+{
     for (BYTE cyl = 0 ; cyl < m_uTracks ; cyl++)
+    {
         for (BYTE head = 0 ; head < m_uSides ; head++)
-            delete[] m_apTracks[head][cyl];
+        {
+            if (!m_apTracks[head][cyl])
+                continue;
+
+            UINT uSize = m_abSizes[head][cyl] << 8;
+            BYTE *pb = new BYTE[uSize];
+            memcpy(pb, m_apTracks[head][cyl], uSize);
+            m_apTracks[head][cyl] = reinterpret_cast<EDSK_TRACK*>(pb);
+        }
+    }
+
+    m_fMapped = false;
 }
 
 // Find the next sector in the current track
@@ -590,14 +911,39 @@ BYTE CEDSKDisk::WriteData (BYTE cyl_, BYTE head_, BYTE index_, BYTE *pbData_, UI
     m_pSector->bStatus1 &= ~ST1_765_CRC_ERROR;
     m_pSector->bStatus2 &= ~ST2_765_CRC_ERROR;
 
-    SetModified();
+    // Mark the track as changed
+    SetDirty(cyl_*m_uSides + head_);
     return 0;
 }
 
-// Save the disk out to the stream
+// Save the disk changes out to the stream
 bool CEDSKDisk::Save ()
 {
     BYTE abHeader[256] = {0}, cyl, head;
+    size_t uOffset = sizeof(abHeader);
+    bool fRet = BeginSave();
+
+    // Update just the changed tracks if the layout hasn't changed
+    if (m_fMapped || (!m_fRewrite && m_pStream->CanWriteAt()))
+    {
+        for (cyl = 0 ; cyl < m_uTracks ; cyl++)
+        {
+            for (head = 0 ; head < m_uSides ; head++)
+            {
+                UINT uSize = m_abSizes[head][cyl] << 8;
+
+                if (m_apTracks[head][cyl] && m_afDirty[cyl*m_uSides + head])
+                    QueueWrite(uOffset, m_apTracks[head][cyl], uSize, false, cyl*m_uSides + head, 1);
+
+                uOffset += uSize;
+            }
+        }
+
+        memset(m_afDirty, 0, sizeof(m_afDirty));
+        SetModified(false);
+        return fRet;
+    }
+
     EDSK_HEADER *peh = reinterpret_cast<EDSK_HEADER*>(abHeader);
     BYTE *pbSizes = reinterpret_cast<BYTE*>(peh+1);
 
@@ -612,11 +958,18 @@ bool CEDSKDisk::Save ()
         for (head = 0 ; head < m_uSides ; head++)
             *pbSizes++ = m_abSizes[head][cyl];
 
-    // Write the disk header
-    bool fSuccess = m_pStream->Rewind() && m_pStream->Write(&abHeader, sizeof(abHeader)) == sizeof(abHeader);
+    // Determine the full image size
+    for (cyl = 0 ; cyl < m_uTracks ; cyl++)
+        for (head = 0 ; head < m_uSides ; head++)
+            if (m_apTracks[head][cyl])
+                uOffset += m_abSizes[head][cyl] << 8;
+
+    // Assemble the disk header and track data into a single image
+    BYTE *pbImage = new BYTE[uOffset], *pb = pbImage;
+    memcpy(pb, abHeader, sizeof(abHeader));
+    pb += sizeof(abHeader);
 
-    // Write the track data
-    for (cyl = 0 ; fSuccess && cyl < m_uTracks ; cyl++)
+    for (cyl = 0 ; cyl < m_uTracks ; cyl++)
     {
         for (head = 0 ; head < m_uSides ; head++)
         {
@@ -625,18 +978,20 @@ bool CEDSKDisk::Save ()
                 continue;
 
             UINT uSize = m_abSizes[head][cyl] << 8;
-            fSuccess &= (m_pStream->Write(m_apTracks[head][cyl], uSize) == uSize);
+            memcpy(pb, m_apTracks[head][cyl], uSize);
+            pb += uSize;
         }
     }
 
-    // Any problems?
-    if (!fSuccess)
-        return false;
+    // Rewrite the whole image
+    QueueWrite(0, pbImage, uOffset, true);
+    delete[] pbImage;
 
-    m_pStream->Close();
+    memset(m_afDirty, 0, sizeof(m_afDirty));
+    m_fRewrite = false;
     SetModified(false);
 
-    return true;
+    return fRet;
 }
 
 // Format a track using the specified format
@@ -668,6 +1023,10 @@ BYTE CEDSKDisk::FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDa
     if (uDataTotal > 0xff00)
         return WRITE_PROTECT;
 
+    // The track layout is changing, so we need our own copy of a mapped image
+    if (m_fMapped)
+        Detach();
+
     // Allocate space for the new track
     BYTE* pb = new BYTE[uDataTotal];
     memset(pb, 0, uDataTotal);
@@ -716,8 +1075,8 @@ BYTE CEDSKDisk::FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDa
     if (cyl_ >= m_uTracks) m_uTracks = cyl_+1;
     if (head_ >= m_uSides) m_uSides = head_+1;
 
-    // Mark the disk stream as modified
-    SetModified();
+    // The track size may have changed, so the whole image must be rewritten
+    SetRewrite();
 
     return 0;
 }
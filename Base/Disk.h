@@ -36,6 +36,8 @@ const UINT NORMAL_DIRECTORY_TRACKS = 4;  // Normally 4 tracks in a SAMDOS direct
 
 const UINT DOS_DISK_SECTORS = 9;         // Double-density MS-DOS disks are 9 sectors per track
 
+const UINT MAX_IMAGE_TRACKS = 256;       // Track limit for write-back tracking, covering the largest SAD geometry
+
 
 // The various disk format image sizes
 #define MGT_IMAGE_SIZE  (NORMAL_DISK_SIDES * NORMAL_DISK_TRACKS * NORMAL_DISK_SECTORS * NORMAL_SECTOR_SIZE)
@@ -133,7 +135,10 @@ class CDisk
         static CDisk* Open (const char* pcszDisk_, bool fReadOnly_=false);
         static CDisk* Open (void* pv_, size_t uSize_, const char* pcszDisk_);
 
-        virtual void Close () { m_pStream->Close(); }
+        static void WaitWrites ();
+        static bool GetWriteError (char* pszFile_, size_t uLen_);
+
+        virtual void Close ();
         virtual void Flush () { }
         virtual bool Save () { return false; };
         virtual BYTE FormatTrack (BYTE /*cyl_*/, BYTE /*head_*/, IDFIELD* /*paID_*/, BYTE* /*papbData_*/[], UINT /*uSectors_*/) { return WRITE_PROTECT; }
@@ -148,6 +153,12 @@ class CDisk
 
         void SetModified (bool fModified_=true) { m_fModified = fModified_; }
 
+        bool CheckWrites ();
+
+        bool HasOverlay () const { return m_pStream->HasOverlay(); }
+        bool CommitOverlay ();
+        bool DiscardOverlay ();
+
     // Protected overrides
     protected:
         virtual BYTE LoadTrack (BYTE /*cyl_*/, BYTE /*head_*/) { m_nBusy = LOAD_DELAY; return 0; }
@@ -157,11 +168,22 @@ class CDisk
 
         virtual bool IsBusy (BYTE* /*pbStatus_*/, bool /*fWait_*/=false) { if (!m_nBusy) return false; m_nBusy--; return true; }
 
+        void SetDirty (UINT uTrack_) { m_afDirty[uTrack_] = true; SetModified(); }
+        void SetRewrite () { m_fRewrite = true; SetModified(); }
+        bool BeginSave ();
+        bool SaveImage (size_t uTrackBase_, size_t uTrackSize_, UINT uTracks_, size_t uImageSize_);
+        void QueueWrite (size_t uOffset_, const void* pv_, size_t uLen_, bool fRewrite_, UINT uTrack_=0, UINT uTracks_=0);
+
     protected:
         int m_nType;
         int m_nBusy;
         bool m_fModified;
 
+        bool m_afDirty[MAX_IMAGE_TRACKS];   // Tracks changed since the last save, in image file order
+        bool m_fRewrite;                    // Whole image must be rewritten on the next save?
+        bool m_fMapped;                     // Image data is in the stream mapping rather than our own memory?
+        bool m_fWriteFailed;                // Changes failed to save since the last Save()?
+
         CStream *m_pStream;
         BYTE *m_pbData;
 };
@@ -226,6 +248,9 @@ class CEDSKDisk final : public CDisk
         bool Save () override;
         BYTE FormatTrack (BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbData_[], UINT uSectors_) override;
 
+    protected:
+        void Detach ();
+
     protected:
         UINT m_uSides = 0, m_uTracks = 0;
 
@@ -65,6 +65,8 @@ bool CDrive::Insert (const char* pcszSource_, bool fAutoLoad_)
 
     // Open the new disk image
     m_pDisk = CDisk::Open(pcszSource_);
+    InvalidateIndex();
+    InvalidateRawTracks();
     if (!m_pDisk)
         return false;
 
@@ -82,6 +84,38 @@ void CDrive::Eject ()
         m_pDisk->Save();
 
     delete m_pDisk, m_pDisk = nullptr;
+    InvalidateIndex();
+    InvalidateRawTracks();
+}
+
+// Write overlay changes to the image, including any not yet saved
+bool CDrive::CommitOverlay ()
+{
+    if (!HasOverlay())
+        return false;
+
+    if (m_pDisk->IsModified())
+        m_pDisk->Save();
+
+    // The overlay must be up to date before it's copied
+    CDisk::WaitWrites();
+    return m_pDisk->CommitOverlay();
+}
+
+// Throw away overlay changes, and reload the unchanged image
+bool CDrive::DiscardOverlay ()
+{
+    if (!HasOverlay())
+        return false;
+
+    CDisk::WaitWrites();
+    m_pDisk->SetModified(false);
+
+    if (!m_pDisk->DiscardOverlay())
+        return false;
+
+    std::string strPath = m_pDisk->GetPath();
+    return Insert(strPath.c_str());
 }
 
 void CDrive::FrameEnd ()
@@ -89,6 +123,10 @@ void CDrive::FrameEnd ()
     // Base implementation includes default activity handling
     CDiskDevice::FrameEnd();
 
+    // Mark changes that failed to save as unsaved again
+    if (m_pDisk)
+        m_pDisk->CheckWrites();
+
     // If the motor hasn't been used for 2 seconds, switch it off
     if (m_nMotorDelay && !--m_nMotorDelay)
     {
@@ -621,9 +659,53 @@ void CDrive::Out (WORD wPort_, BYTE bVal_)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Index the sectors on the track under the head, returning false if the index can't be used
+bool CDrive::IndexTrack ()
+{
+    // Real disks re-read the track for each command, so the contents may change under us
+    if (m_pDisk->m_nType == dtFloppy)
+        return false;
+
+    if (!m_fIndexed || m_bIndexCyl != m_bHeadCyl || m_bIndexHead != m_bSide)
+    {
+        UINT u;
+
+        // Fetch the ID fields once, so their CRCs aren't recalculated on every search
+        for (u = 0 ; u < MAX_INDEX_SECTORS ; u++)
+        {
+            if (!m_pDisk->GetSector(m_bHeadCyl, m_bSide, u, &m_aIndexID[u], &m_abIndexStatus[u]))
+                break;
+        }
+
+        // Chain sectors with the same number, in rotational order
+        memset(m_abFirstIndex, 0xff, sizeof(m_abFirstIndex));
+        for (UINT v = u ; v-- > 0 ; )
+        {
+            m_abNextIndex[v] = m_abFirstIndex[m_aIndexID[v].bSector];
+            m_abFirstIndex[m_aIndexID[v].bSector] = v;
+        }
+
+        m_uIndexSectors = u;
+        m_bIndexCyl = m_bHeadCyl;
+        m_bIndexHead = m_bSide;
+        m_fIndexed = true;
+    }
+
+    // Tracks with more sectors than we can index are searched the slow way
+    return m_uIndexSectors < MAX_INDEX_SECTORS;
+}
+
 bool CDrive::GetSector (BYTE index_, IDFIELD *pID_, BYTE *pbStatus_)
 {
-    return m_pDisk->GetSector(m_bHeadCyl, m_bSide, index_, pID_, pbStatus_);
+    if (!IndexTrack())
+        return m_pDisk->GetSector(m_bHeadCyl, m_bSide, index_, pID_, pbStatus_);
+
+    if (index_ >= m_uIndexSectors)
+        return false;
+
+    *pID_ = m_aIndexID[index_];
+    *pbStatus_ = m_abIndexStatus[index_];
+    return true;
 }
 
 // Locate the sector matching the current register details
@@ -632,6 +714,23 @@ bool CDrive::FindSector (IDFIELD* pID_)
     IDFIELD id;
     BYTE bStatus;
 
+    // Look up the first match in rotational order from the index, if available
+    if (IndexTrack())
+    {
+        for (BYTE b = m_abFirstIndex[m_sRegs.bSector] ; b != 0xff ; b = m_abNextIndex[b])
+        {
+            if (m_aIndexID[b].bTrack == m_sRegs.bTrack)
+            {
+                *pID_ = m_aIndexID[b];
+                m_bSectorIndex = b;
+                return true;
+            }
+        }
+
+        m_bSectorIndex = 0;
+        return false;
+    }
+
     int nIndexCount = 0;
     m_bSectorIndex = 0;
 
@@ -639,7 +738,7 @@ bool CDrive::FindSector (IDFIELD* pID_)
     while (nIndexCount < 2)
     {
         // Fetch the next sector details
-        if (!m_pDisk->GetSector(m_bHeadCyl, m_bSide, m_bSectorIndex, &id, &bStatus))
+        if (!GetSector(m_bSectorIndex, &id, &bStatus))
         {
             // If we've run out of sectors, loop back to the start of the track
             nIndexCount++;
@@ -669,6 +768,9 @@ BYTE CDrive::ReadSector (BYTE* pbData_, UINT* puSize_)
 
 BYTE CDrive::WriteSector (BYTE* pbData_, UINT* puSize_)
 {
+    // Writing can clear a sector's CRC error, changing its ID status as well as the track data
+    InvalidateIndex();
+    InvalidateRawTrack();
     return m_pDisk->WriteData(m_bHeadCyl, m_bSide, m_bSectorIndex, pbData_, puSize_);
 }
 
@@ -678,8 +780,8 @@ BYTE CDrive::ReadAddress (IDFIELD* pID_)
     BYTE bStatus = RECORD_NOT_FOUND;
 
     // Fetch a sector, wrapping if necessary
-    if (!m_pDisk->GetSector(m_bHeadCyl, m_bSide, m_bSectorIndex, pID_, &bStatus))
-        m_pDisk->GetSector(m_bHeadCyl, m_bSide, m_bSectorIndex = 0, pID_, &bStatus);
+    if (!GetSector(m_bSectorIndex, pID_, &bStatus))
+        GetSector(m_bSectorIndex = 0, pID_, &bStatus);
 
     // Advance to next sector
     m_bSectorIndex++;
@@ -695,12 +797,49 @@ static void PutBlock (BYTE*& rpb_, BYTE bVal_, int nCount_=1)
         *rpb_++ = bVal_;
 }
 
+// Cache slot for the raw track under the head, or nullptr if it can't be cached
+BYTE** CDrive::RawTrackCache ()
+{
+    // Real disks re-read the track for each command, so the contents may change under us
+    if (!m_pDisk || m_pDisk->m_nType == dtFloppy || m_bSide >= MAX_DISK_SIDES || m_bHeadCyl >= MAX_DISK_TRACKS)
+        return nullptr;
+
+    return &m_apbRawTracks[m_bSide][m_bHeadCyl];
+}
+
+// Discard the cached raw track under the head, after it's been written or formatted
+void CDrive::InvalidateRawTrack ()
+{
+    BYTE **ppb = RawTrackCache();
+    if (ppb)
+        delete[] *ppb, *ppb = nullptr;
+}
+
+// Discard all cached raw tracks, when the disk is changed
+void CDrive::InvalidateRawTracks ()
+{
+    for (UINT uSide = 0 ; uSide < MAX_DISK_SIDES ; uSide++)
+    {
+        for (UINT uCyl = 0 ; uCyl < MAX_DISK_TRACKS ; uCyl++)
+            delete[] m_apbRawTracks[uSide][uCyl], m_apbRawTracks[uSide][uCyl] = nullptr;
+    }
+}
+
 // Construct the raw track from the information of each sector on the track to make it look real
 void CDrive::ReadTrack (BYTE* pbTrack_, UINT uSize_)
 {
     IDFIELD id;
     BYTE bStatus;
 
+    // Serve repeat reads of an unchanged track from the cache
+    BYTE **ppbCache = RawTrackCache();
+    if (ppbCache && *ppbCache)
+    {
+        memcpy(pbTrack_, *ppbCache, uSize_);
+        m_bSectorIndex = m_abRawTrackSectors[m_bSide][m_bHeadCyl];
+        return;
+    }
+
     // Initialise track with 4E gap filler
     memset(pbTrack_, 0x4e, uSize_);
 
@@ -757,6 +896,14 @@ void CDrive::ReadTrack (BYTE* pbTrack_, UINT uSize_)
     }
 
     PutBlock(pb, 0x4e, 16);         // Gap 4: min 16 bytes of 0x4e
+
+    // Keep a copy for next time
+    if (ppbCache)
+    {
+        *ppbCache = new BYTE[uSize_];
+        memcpy(*ppbCache, pbTrack_, uSize_);
+        m_abRawTrackSectors[m_bSide][m_bHeadCyl] = m_bSectorIndex;
+    }
 }
 
 
@@ -849,6 +996,10 @@ BYTE CDrive::WriteTrack (BYTE* pbTrack_, UINT uSize_)
     // Present the format to the disk for laying out
     BYTE bStatus = m_pDisk ? m_pDisk->FormatTrack(m_bHeadCyl, m_bSide, paID, papbData, nSectors) : WRITE_PROTECT;
 
+    // The track layout may have changed
+    InvalidateIndex();
+    InvalidateRawTrack();
+
     delete[] paID;
     delete[] papbData;
 
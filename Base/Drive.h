@@ -34,6 +34,8 @@ const int FLOPPY_MOTOR_TIMEOUT = (10 / (FLOPPY_RPM/60)) * EMULATED_FRAMES_PER_SE
 
 const unsigned int FLOPPY_ACTIVE_FRAMES = 5;   // Frames the floppy is considered active after a command
 
+const UINT MAX_INDEX_SECTORS = 255;            // Sectors covered by the track index (0xff marks no entry)
+
 
 class CDrive final : public CDiskDevice
 {
@@ -64,6 +66,10 @@ class CDrive final : public CDiskDevice
 
         void SetDiskModified (bool fModified_=true) override { if (m_pDisk) m_pDisk->SetModified(fModified_); }
 
+        bool HasOverlay () const override { return m_pDisk && m_pDisk->HasOverlay(); }
+        bool CommitOverlay () override;
+        bool DiscardOverlay () override;
+
     protected:
         bool GetSector (BYTE index_, IDFIELD *pID_, BYTE *pbStatus_);
         bool FindSector (IDFIELD* pID_);
@@ -74,6 +80,13 @@ class CDrive final : public CDiskDevice
         BYTE VerifyTrack ();
         BYTE WriteTrack (BYTE* pbTrack_, UINT uSize_);
 
+        bool IndexTrack ();
+        void InvalidateIndex () { m_fIndexed = false; }
+
+        BYTE** RawTrackCache ();
+        void InvalidateRawTrack ();
+        void InvalidateRawTracks ();
+
     protected:
         void ModifyStatus (BYTE bEnable_, BYTE bReset_);
         void ModifyReadStatus ();
@@ -96,6 +109,17 @@ class CDrive final : public CDiskDevice
 
         int m_nState = 0;           // Command state, for tracking multi-stage execution
         int m_nMotorDelay = 0;      // Delay before switching motor off
+
+        bool m_fIndexed = false;    // Index of the track under the head, built on first use
+        BYTE m_bIndexCyl = 0, m_bIndexHead = 0;
+        UINT m_uIndexSectors = 0;
+        IDFIELD m_aIndexID[MAX_INDEX_SECTORS];      // ID fields, including CRCs
+        BYTE m_abIndexStatus[MAX_INDEX_SECTORS];    // ID field status
+        BYTE m_abFirstIndex[256];                   // Lowest index of each sector number
+        BYTE m_abNextIndex[MAX_INDEX_SECTORS];      // Next index with the same sector number
+
+        BYTE *m_apbRawTracks[MAX_DISK_SIDES][MAX_DISK_TRACKS] = {}; // Raw tracks built for READ_TRACK, if unchanged since
+        BYTE m_abRawTrackSectors[MAX_DISK_SIDES][MAX_DISK_TRACKS] = {};
 };
 
 #endif // DRIVE_H
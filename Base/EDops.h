@@ -336,13 +336,13 @@ edinstr(4,0261) cpi((F & 0x44) == 4);                               endinstr;
 edinstr(4,0271) cpd((F & 0x44) == 4);                               endinstr;   // cpdr
 
 
-edinstr(5,0242) ini(false);                                         endinstr;   // ini
+edinstr(5,0242) if (IO::IniHook()) break; ini(false);              endinstr;   // ini
 edinstr(5,0252) ind(false);                                         endinstr;   // ind
 edinstr(5,0262) ini(B);                                             endinstr;   // inir
 edinstr(5,0272) ind(B);                                             endinstr;   // indr
 
 
-edinstr(5,0243) oti(false);                                         endinstr;   // outi
+edinstr(5,0243) if (IO::OutiHook()) break; oti(false);             endinstr;   // outi
 edinstr(5,0253) otd(false);                                         endinstr;   // outd
 edinstr(5,0263) oti(B);                                             endinstr;   // otir
 edinstr(5,0273) otd(B);                                             endinstr;   // otdr
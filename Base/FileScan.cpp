@@ -0,0 +1,318 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// FileScan.cpp: Background directory listing and disk image identification
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  The directory is listed on a background thread, with entries passed on
+//  in batches so large directories can be shown as they're read. Once the
+//  listing is complete, the files chosen by the viewer are identified with
+//  CDisk::GetType, spread over a worker pool as each may mean opening and
+//  inflating an archive.
+//
+//  Identified types are kept in a cache file, keyed by the full path, size
+//  and modification time, so later scans needn't open unchanged files.
+
+#include "SimCoupe.h"
+#include "FileScan.h"
+
+#include "Disk.h"
+#include "ThreadPool.h"
+#include "Util.h"
+
+static const char TYPE_CACHE_SIGNATURE[] = "SimCoupe image types 1";
+
+typedef struct
+{
+    uint64_t ullSize;
+    int64_t llTime;
+    int nType;
+}
+TYPE_CACHE_ENTRY;
+
+static std::map<std::string, TYPE_CACHE_ENTRY> mapTypes;    // Identified files, by full path
+static std::mutex mTypes;
+static bool fTypesLoaded, fTypesChanged;
+
+
+static void LoadTypeCache (const char* pcszPath_)
+{
+    FILE* hf = fopen(pcszPath_, "r");
+    fTypesLoaded = true;
+
+    if (!hf)
+        return;
+
+    char sz[MAX_PATH+64];
+    if (fgets(sz, sizeof(sz), hf) && !strncmp(sz, TYPE_CACHE_SIGNATURE, strlen(TYPE_CACHE_SIGNATURE)))
+    {
+        // Each line holds the type, size and time, followed by the path
+        while (fgets(sz, sizeof(sz), hf))
+        {
+            TYPE_CACHE_ENTRY sEntry;
+            unsigned long long ullSize;
+            long long llTime;
+            int nPath = 0;
+
+            sz[strcspn(sz, "\r\n")] = '\0';
+
+            if (sscanf(sz, "%d %llu %lld %n", &sEntry.nType, &ullSize, &llTime, &nPath) == 3 && nPath && sz[nPath])
+            {
+                sEntry.ullSize = ullSize;
+                sEntry.llTime = llTime;
+                mapTypes[sz+nPath] = sEntry;
+            }
+        }
+    }
+
+    fclose(hf);
+    TRACE("Loaded %u cached image types\n", static_cast<UINT>(mapTypes.size()));
+}
+
+static bool SaveTypeCache (const char* pcszPath_)
+{
+    // Other instances may be saving too, so the temporary file is our own
+    std::string strTemp = GetTempFile(pcszPath_);
+    FILE* hf = fopen(strTemp.c_str(), "w");
+
+    if (!hf)
+        return false;
+
+    fprintf(hf, "%s\n", TYPE_CACHE_SIGNATURE);
+
+    for (auto &it : mapTypes)
+    {
+        fprintf(hf, "%d %llu %lld %s\n", it.second.nType, static_cast<unsigned long long>(it.second.ullSize),
+                static_cast<long long>(it.second.llTime), it.first.c_str());
+    }
+
+    bool fWritten = !ferror(hf);
+    fWritten = !fclose(hf) && fWritten;
+
+    // Replace the old cache only once the new one is complete
+    if (!CommitTempFile(strTemp.c_str(), pcszPath_, fWritten))
+    {
+        TRACE("!!! Failed to save image type cache to %s\n", pcszPath_);
+        return false;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CFileScan::CFileScan (const char* pcszPath_, const char* pcszFilter_, bool fShowHidden_, PFNSCANFILTER pfnIdentify_, const char* pcszCache_)
+    : m_strPath(pcszPath_), m_fShowHidden(fShowHidden_), m_pfnIdentify(pfnIdentify_), m_strCache(pcszCache_)
+{
+    // Split the filter into its list of extensions
+    std::string strFilter = pcszFilter_;
+    for (size_t uStart = 0, uEnd ; uStart < strFilter.length() ; uStart = uEnd+1)
+    {
+        if ((uEnd = strFilter.find(';', uStart)) == std::string::npos)
+            uEnd = strFilter.length();
+
+        m_dFilters.push_back(strFilter.substr(uStart, uEnd-uStart));
+    }
+
+    m_pThread = new std::thread(&CFileScan::ScanProc, this);
+}
+
+CFileScan::~CFileScan ()
+{
+    // Abandon the scan, which waits for only the files currently being identified
+    m_fCancel = true;
+    m_pThread->join();
+    delete m_pThread;
+}
+
+
+// Collect the entries listed since the last call, returning true if there were any
+bool CFileScan::GetEntries (std::deque<SCAN_ENTRY> &dEntries_)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    dEntries_.clear();
+    dEntries_.swap(m_dEntries);
+    return !dEntries_.empty();
+}
+
+// Collect the files identified since the last call, returning true if there were any
+bool CFileScan::GetTypes (std::deque<SCAN_ENTRY> &dTypes_)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    dTypes_.clear();
+    dTypes_.swap(m_dTypes);
+    return !dTypes_.empty();
+}
+
+void CFileScan::Publish (std::deque<SCAN_ENTRY> &dTo_, std::deque<SCAN_ENTRY> &dFrom_)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    dTo_.insert(dTo_.end(), dFrom_.begin(), dFrom_.end());
+    dFrom_.clear();
+}
+
+
+void CFileScan::ScanProc ()
+{
+    std::deque<SCAN_ENTRY> dBatch, dIdentify;
+
+    DIR* dir = opendir(m_strPath.c_str());
+    if (dir)
+    {
+        for (struct dirent* entry ; !m_fCancel && (entry = readdir(dir)) ; )
+        {
+            SCAN_ENTRY sEntry;
+            if (!Examine(entry->d_name, sEntry))
+                continue;
+
+            // Note files to identify once the listing is complete
+            if (!sEntry.fDir && !sEntry.fDevice && m_pfnIdentify && m_pfnIdentify(entry->d_name))
+                dIdentify.push_back(sEntry);
+
+            dBatch.push_back(sEntry);
+
+            if (dBatch.size() >= SCAN_BATCH)
+                Publish(m_dEntries, dBatch);
+        }
+
+        closedir(dir);
+        Publish(m_dEntries, dBatch);
+    }
+
+    if (!m_fCancel && !dIdentify.empty())
+        Identify(dIdentify);
+
+    m_fDone = true;
+}
+
+// Fill in the details of a directory entry, returning false if it shouldn't be listed
+bool CFileScan::Examine (const char* pcszName_, SCAN_ENTRY &sEntry_) const
+{
+    // Ignore . and .. (the viewer adds its own .. if required)
+    if (!strcmp(pcszName_, ".") || !strcmp(pcszName_, ".."))
+        return false;
+
+    std::string strPath = m_strPath + pcszName_;
+    struct stat st;
+
+    // Skip hidden entries unless they're wanted, and anything we can't examine
+    if ((!m_fShowHidden && OSD::IsHidden(strPath.c_str())) || stat(strPath.c_str(), &st) != 0)
+        return false;
+
+    // Only regular files are affected by the file filter
+    if (S_ISREG(st.st_mode))
+    {
+        const char* pcszExt = strrchr(pcszName_, '.');
+
+        // Ignore files with no extension, or an extension that isn't in the filter list
+        if (!m_dFilters.empty() && (!pcszExt || std::none_of(m_dFilters.begin(), m_dFilters.end(),
+                [=] (const std::string &str) { return !strcasecmp(str.c_str(), pcszExt); })))
+            return false;
+    }
+
+    // Ignore anything that isn't a directory or a block device (or a symbolic link to one)
+    else if (!S_ISDIR(st.st_mode) && !S_ISBLK(st.st_mode))
+        return false;
+
+    sEntry_.strName = pcszName_;
+    sEntry_.fDir = S_ISDIR(st.st_mode);
+    sEntry_.fDevice = S_ISBLK(st.st_mode);
+    sEntry_.ullSize = static_cast<uint64_t>(st.st_size);
+    sEntry_.llTime = static_cast<int64_t>(st.st_mtime);
+    sEntry_.nType = dtNone;
+
+    return true;
+}
+
+
+// Determine the disk types of the supplied files, using the cache where possible
+void CFileScan::Identify (std::deque<SCAN_ENTRY> &dFiles_)
+{
+    std::deque<SCAN_ENTRY> dDone;
+
+    {
+        std::lock_guard<std::mutex> lock(mTypes);
+
+        if (!fTypesLoaded)
+            LoadTypeCache(m_strCache.c_str());
+
+        // Unchanged files use the cached type, leaving the rest for the pool
+        for (auto &sEntry : dFiles_)
+        {
+            auto it = mapTypes.find(m_strPath + sEntry.strName);
+            if (it != mapTypes.end() && it->second.ullSize == sEntry.ullSize && it->second.llTime == sEntry.llTime)
+            {
+                sEntry.nType = it->second.nType;
+                dDone.push_back(sEntry);
+            }
+            else
+                m_dPending.push_back(sEntry);
+        }
+    }
+
+    Publish(m_dTypes, dDone);
+
+    if (m_dPending.empty())
+        return;
+
+    CThreadPool* pPool = new CThreadPool;
+
+    // Identify in small runs, so results appear steadily and cancelling is prompt
+    for (m_uFirst = 0 ; !m_fCancel && m_uFirst < m_dPending.size() ; m_uFirst += IDENTIFY_BATCH)
+    {
+        size_t uItems = std::min(IDENTIFY_BATCH, m_dPending.size() - m_uFirst);
+        pPool->Run(IdentifyBand, this, static_cast<int>(uItems));
+
+        std::lock_guard<std::mutex> lock(mTypes);
+
+        for (size_t u = m_uFirst ; u < m_uFirst + uItems ; u++)
+        {
+            const SCAN_ENTRY &sEntry = m_dPending[u];
+
+            // Skip anything left unidentified by a cancelled run
+            if (sEntry.nType != dtNone)
+            {
+                mapTypes[m_strPath + sEntry.strName] = { sEntry.ullSize, sEntry.llTime, sEntry.nType };
+                fTypesChanged = true;
+                dDone.push_back(sEntry);
+            }
+        }
+
+        Publish(m_dTypes, dDone);
+    }
+
+    delete pPool;
+
+    std::lock_guard<std::mutex> lock(mTypes);
+    if (fTypesChanged && SaveTypeCache(m_strCache.c_str()))
+        fTypesChanged = false;
+}
+
+/*static*/ void CFileScan::IdentifyBand (void *pvParam_, int nFrom_, int nTo_)
+{
+    CFileScan* pThis = static_cast<CFileScan*>(pvParam_);
+
+    for (int i = nFrom_ ; i < nTo_ && !pThis->m_fCancel ; i++)
+    {
+        SCAN_ENTRY &sEntry = pThis->m_dPending[pThis->m_uFirst + i];
+
+        CStream* pStream = CStream::Open((pThis->m_strPath + sEntry.strName).c_str(), true);
+        sEntry.nType = CDisk::GetType(pStream);
+        delete pStream;
+    }
+}
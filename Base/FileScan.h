@@ -0,0 +1,83 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// FileScan.h: Background directory listing and disk image identification
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef FILESCAN_H
+#define FILESCAN_H
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+const size_t SCAN_BATCH = 256;          // Entries listed before passing them on to the viewer
+const size_t IDENTIFY_BATCH = 64;       // Files identified by the worker pool in each run
+
+typedef bool (*PFNSCANFILTER)(const char* pcszFile_);
+
+typedef struct
+{
+    std::string strName;    // Name within the scanned directory
+    bool fDir;              // Directory, or a link to one?
+    bool fDevice;           // Block device?
+    uint64_t ullSize;       // Size and modification time, which key the type cache
+    int64_t llTime;
+    int nType;              // Disk type from CDisk::GetType, or dtNone if not yet known
+}
+SCAN_ENTRY;
+
+// Lists a directory on a background thread, then identifies selected files using a worker pool
+class CFileScan final
+{
+    public:
+        CFileScan (const char* pcszPath_, const char* pcszFilter_, bool fShowHidden_, PFNSCANFILTER pfnIdentify_, const char* pcszCache_);
+        CFileScan (const CFileScan &) = delete;
+        void operator= (const CFileScan &) = delete;
+        ~CFileScan ();
+
+    public:
+        bool IsDone () const { return m_fDone; }
+        bool GetEntries (std::deque<SCAN_ENTRY> &dEntries_);
+        bool GetTypes (std::deque<SCAN_ENTRY> &dTypes_);
+
+    protected:
+        void ScanProc ();
+        bool Examine (const char* pcszName_, SCAN_ENTRY &sEntry_) const;
+        void Identify (std::deque<SCAN_ENTRY> &dFiles_);
+        void Publish (std::deque<SCAN_ENTRY> &dTo_, std::deque<SCAN_ENTRY> &dFrom_);
+
+        static void IdentifyBand (void *pvParam_, int nFrom_, int nTo_);
+
+    protected:
+        std::string m_strPath;                  // Directory to list, with a trailing separator
+        std::deque<std::string> m_dFilters;     // File extensions to include, or empty for all files
+        bool m_fShowHidden = false;
+        PFNSCANFILTER m_pfnIdentify = nullptr;  // Selects the files to identify
+        std::string m_strCache;                 // Type cache file
+
+        std::thread *m_pThread = nullptr;
+        std::atomic<bool> m_fCancel {false}, m_fDone {false};
+
+        std::mutex m_mutex {};                  // Guards the results waiting for the viewer
+        std::deque<SCAN_ENTRY> m_dEntries, m_dTypes;
+
+        std::deque<SCAN_ENTRY> m_dPending;      // Files being identified by the pool
+        size_t m_uFirst = 0;                    // Start of the current pool run in m_dPending
+};
+
+#endif  // FILESCAN_H
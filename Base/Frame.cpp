@@ -97,6 +97,8 @@ namespace Frame
 {
 static void DrawOSD (CScreen *pScreen_);
 static void Flip (CScreen *pScreen_);
+static void FlipGui ();
+static void DrawGui (bool fRedrawAll_, int &rnOverlayTop_, int &rnOverlayBottom_);
 
 bool Init (bool fFirstInit_/*=false*/)
 {
@@ -119,7 +121,7 @@ bool Init (bool fFirstInit_/*=false*/)
     s_nWidth = (s_nViewRight - s_nViewLeft) << 4;
     s_nHeight = (s_nViewBottom - s_nViewTop) << 1;
 
-    // Create two SAM screens and two GUI screens, to allow for double-buffering
+    // Create two SAM screens to allow for double-buffering, plus the GUI screen and a copy of its last overlay
     pScreen = new CScreen(s_nWidth, s_nHeight);
     pLastScreen = new CScreen(s_nWidth, s_nHeight);
     pGuiScreen = new CScreen(s_nWidth, s_nHeight);
@@ -341,6 +343,7 @@ static void DrawRaster (CScreen *pScreen_)
     BYTE* pLine0 = pScreen_->GetLine(nLine);
     BYTE* pLine1 = pScreen_->GetLine(nLine+1);
     pLine0[nOffset] = pLine0[nOffset+1] = pLine1[nOffset] = pLine1[nOffset+1] = bColour;
+    pScreen_->MarkDrawnLines(nLine, 2);
 }
 
 
@@ -369,26 +372,11 @@ void End ()
 
         if (GUI::IsActive())
         {
-            // Make a double-height copy of the current frame for the GUI to overlay
-            for (int i = 0 ; i < GetHeight() ; i++)
-            {
-                // Fetch the source line data
-                BYTE *pbLine = pScreen->GetLine(i>>1);
-                int nWidth = pScreen->GetPitch();
-
-                // Copy the frame data
-                memcpy(pGuiScreen->GetLine(i), pbLine, nWidth);
-            }
-
-            // If the debugger is active, highlight the current raster position
-            if (Debug::IsActive())
-                DrawRaster(pGuiScreen);
+            // Let controls pick up background work before deciding what needs redrawing
+            GUI::Idle();
 
-            // Overlay the GUI widgets
-            GUI::Draw(pGuiScreen);
-
-            // Submit the completed frame
-            Flip(pGuiScreen);
+            // Overlay the GUI on the current frame, and submit the result
+            FlipGui();
         }
         else
         {
@@ -474,6 +462,17 @@ void Sync ()
 
         // Format the profile string and reset it
         sprintf(szProfile, "%d%%", nPercent);
+
+        // Include any sound buffer underruns or overruns in the last second
+        static UINT uLastUnderruns, uLastOverruns;
+        UINT uUnderruns, uOverruns;
+        Audio::GetStats(uUnderruns, uOverruns);
+
+        if (uUnderruns != uLastUnderruns || uOverruns != uLastOverruns)
+            sprintf(szProfile+strlen(szProfile), "  U%u O%u", uUnderruns-uLastUnderruns, uOverruns-uLastOverruns);
+
+        uLastUnderruns = uUnderruns;
+        uLastOverruns = uOverruns;
         TRACE("%s  %d frames\n", szProfile, nFrame);
 
         // Adjust for next time, taking care to preserve any fractional part
@@ -487,8 +486,8 @@ void Sync ()
     if (GUI::IsActive())
     {
         // Add a frame's worth of silence
-        static BYTE abSilence[SAMPLE_FREQ*SAMPLE_BLOCK/EMULATED_FRAMES_PER_SECOND];
-        Audio::AddData(abSilence, sizeof(abSilence));
+        static BYTE abSilence[(SAMPLE_FREQ_MAX/EMULATED_FRAMES_PER_SECOND)*SAMPLE_BLOCK];
+        Audio::AddData(abSilence, (Sound::GetSampleFreq()/EMULATED_FRAMES_PER_SECOND)*SAMPLE_BLOCK);
     }
 }
 
@@ -529,7 +528,110 @@ void Flip (CScreen *pScreen_)
 
     // Flip screen buffers
     std::swap(pScreen, pLastScreen);
-    std::swap(pGuiScreen, pLastGuiScreen);
+}
+
+// Compose the GUI display and flip frame buffers
+// The GUI screen holds a line-doubled copy of the frame, and is updated only where the frame
+// has changed. The GUI image is kept from last time unless the GUI has been invalidated or the
+// frame has changed beneath it, in which case the lines it covered are restored and it's redrawn.
+void FlipGui ()
+{
+    static int nOverlayTop = 0, nOverlayBottom = -1;
+
+    int nHeight = pScreen->GetHeight() >> 1;
+    int nPitch = pScreen->GetPitch();
+
+    // Everything must be redrawn if the GUI screen wasn't displayed last time
+    bool fRedrawAll = pDisplayScreen != pGuiScreen;
+    bool fRedrawGui = fRedrawAll || GUI::IsDirty();
+
+    for (int y = 0 ; y < nHeight ; y++)
+    {
+        int i = y << 1;
+        bool fOverlay = i+1 >= nOverlayTop && i <= nOverlayBottom;
+
+        // Overlay lines are dealt with below if the GUI is being redrawn
+        if (fOverlay && fRedrawGui)
+            continue;
+
+        // Skip unchanged lines
+        BYTE *pbLine = pScreen->GetLine(y);
+        if (!fRedrawAll && !memcmp(pbLine, pLastScreen->GetLine(y), nPitch))
+            continue;
+
+        // A change beneath the GUI means it must be redrawn
+        if (fOverlay)
+        {
+            fRedrawGui = true;
+            continue;
+        }
+
+        memcpy(pGuiScreen->GetLine(i), pbLine, nPitch);
+        memcpy(pGuiScreen->GetLine(i+1), pbLine, nPitch);
+        Video::SetLineDirty(i);
+        Video::SetLineDirty(i+1);
+    }
+
+    if (fRedrawGui)
+        DrawGui(fRedrawAll, nOverlayTop, nOverlayBottom);
+
+    // The GUI screen is now the displayed screen
+    pDisplayScreen = pGuiScreen;
+
+    // Flip frame buffers
+    std::swap(pScreen, pLastScreen);
+}
+
+// Restore the frame beneath the GUI and redraw it, updating the range of lines it covers
+void DrawGui (bool fRedrawAll_, int &rnOverlayTop_, int &rnOverlayBottom_)
+{
+    int nPitch = pScreen->GetPitch();
+
+    // Restore the lines covered by the GUI last time
+    for (int i = rnOverlayTop_ & ~1 ; i <= rnOverlayBottom_ ; i += 2)
+    {
+        BYTE *pbLine = pScreen->GetLine(i >> 1);
+        memcpy(pGuiScreen->GetLine(i), pbLine, nPitch);
+        memcpy(pGuiScreen->GetLine(i+1), pbLine, nPitch);
+    }
+
+    pGuiScreen->ResetDrawnLines();
+
+    // If the debugger is active, highlight the current raster position
+    if (Debug::IsActive())
+        DrawRaster(pGuiScreen);
+
+    // Overlay the GUI widgets
+    GUI::Draw(pGuiScreen);
+
+    int nTop, nBottom;
+    if (!pGuiScreen->GetDrawnLines(nTop, nBottom))
+        nTop = pGuiScreen->GetHeight(), nBottom = -1;
+
+    // Compare the old and new overlay lines against the copy of the last overlay
+    for (int i = std::min(nTop, rnOverlayTop_) ; i <= std::max(nBottom, rnOverlayBottom_) ; i++)
+    {
+        bool fOverlay = i >= nTop && i <= nBottom;
+        bool fLastOverlay = i >= rnOverlayTop_ && i <= rnOverlayBottom_;
+
+        if (!fOverlay && !fLastOverlay)
+            continue;
+
+        BYTE *pbLine = pGuiScreen->GetLine(i);
+        BYTE *pbLast = pLastGuiScreen->GetLine(i);
+
+        // Lines new to the overlay have no copy to compare against
+        if (fRedrawAll_ || !fLastOverlay || memcmp(pbLine, pbLast, nPitch))
+        {
+            Video::SetLineDirty(i);
+
+            if (fOverlay)
+                memcpy(pbLast, pbLine, nPitch);
+        }
+    }
+
+    rnOverlayTop_ = nTop;
+    rnOverlayBottom_ = nBottom;
 }
 
 
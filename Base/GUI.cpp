@@ -31,7 +31,9 @@
 
 #include <ctype.h>
 
+#include "Disk.h"
 #include "Expr.h"
+#include "FileScan.h"
 #include "Font.h"
 #include "Frame.h"
 #include "Input.h"
@@ -42,6 +44,8 @@
 
 CWindow *GUI::s_pGUI;
 int GUI::s_nX, GUI::s_nY;
+bool GUI::s_fDirty;
+DWORD GUI::s_dwRedrawTime;
 
 static DWORD dwLastClick = 0;   // Time of last double-click
 
@@ -54,6 +58,9 @@ bool GUI::SendMessage (int nMessage_, int nParam1_/*=0*/, int nParam2_/*=0*/)
     if (!s_pGUI)
         return false;
 
+    // Any message may change what's displayed
+    Invalidate();
+
     // Keep track of the mouse
     if (nMessage_ == GM_MOUSEMOVE)
     {
@@ -130,6 +137,7 @@ bool GUI::Start (CWindow* pGUI_)
     // Silence sound playback
     Sound::Silence();
     Video::SetDirty();
+    Invalidate();
 
     return true;
 }
@@ -155,6 +163,10 @@ void GUI::Delete (CWindow* pWindow_)
 
 void GUI::Draw (CScreen* pScreen_)
 {
+    // Clear any pending invalidation, allowing controls to schedule more while drawing
+    s_fDirty = false;
+    s_dwRedrawTime = 0;
+
     if (s_pGUI)
     {
         CScreen::SetFont(s_pGUI->GetFont());
@@ -169,11 +181,40 @@ void GUI::Draw (CScreen* pScreen_)
 }
 
 
+// Give every window a chance to do background work, outside of drawing
+void GUI::Idle ()
+{
+    if (s_pGUI)
+        IdleRecurse(s_pGUI);
+}
+
+void GUI::IdleRecurse (CWindow* pWindow_)
+{
+    pWindow_->OnIdle();
+
+    for (CWindow* p = pWindow_->m_pChildren ; p ; p = p->m_pNext)
+        IdleRecurse(p);
+}
+
+
 bool GUI::IsModal ()
 {
     return !s_dialogStack.empty();
 }
 
+// Return whether the GUI needs redrawing, or the last drawn image can be kept
+bool GUI::IsDirty ()
+{
+    return s_fDirty || (s_dwRedrawTime && static_cast<int>(OSD::GetTime() - s_dwRedrawTime) >= 0);
+}
+
+// Request a redraw at the given time, for timed effects such as caret flashing
+void GUI::InvalidateAt (DWORD dwTime_)
+{
+    if (!s_dwRedrawTime || static_cast<int>(dwTime_ - s_dwRedrawTime) < 0)
+        s_dwRedrawTime = dwTime_ ? dwTime_ : 1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CWindow::CWindow (CWindow* pParent_/*=nullptr*/, int nX_/*=0*/, int nY_/*=0*/, int nWidth_/*=0*/, int nHeight_/*=0*/, int nType_/*=ctUnknown*/)
@@ -309,6 +350,8 @@ void CWindow::SetParent (CWindow* pParent_/*=nullptr*/)
         m_pParent = m_pNext = nullptr;
     }
 
+    Invalidate();
+
     // Set the new parent, if any
     if (pParent_ && pParent_ != this)
     {
@@ -351,6 +394,8 @@ void CWindow::Activate ()
 {
     if (m_pParent)
         m_pParent->m_pActive = this;
+
+    Invalidate();
 }
 
 
@@ -360,6 +405,8 @@ void CWindow::SetText (const char* pcszText_)
     char* pcszOld = m_pszText;
     strcpy(m_pszText = new char[strlen(pcszText_)+1], pcszText_);
     delete[] pcszOld;
+
+    Invalidate();
 }
 
 UINT CWindow::GetValue () const
@@ -441,12 +488,14 @@ void CWindow::Move (int nX_, int nY_)
 {
     // Perform a recursive relative move of the window and all children
     MoveRecurse(this, nX_ - m_nX, nY_ - m_nY);
+    Invalidate();
 }
 
 void CWindow::Offset (int ndX_, int ndY_)
 {
     // Perform a recursive relative move of the window and all children
     MoveRecurse(this, ndX_, ndY_);
+    Invalidate();
 }
 
 
@@ -454,12 +503,14 @@ void CWindow::SetSize (int nWidth_, int nHeight_)
 {
     if (nWidth_) m_nWidth = nWidth_;
     if (nHeight_) m_nHeight = nHeight_;
+    Invalidate();
 }
 
 void CWindow::Inflate (int ndW_, int ndH_)
 {
     m_nWidth += ndW_;
     m_nHeight += ndH_;
+    Invalidate();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -878,7 +929,11 @@ void CEditControl::Draw (CScreen* pScreen_)
     // If the control is enabled and focussed we'll show a flashing caret after the text
     if (IsEnabled() && IsActive())
     {
-        bool fCaretOn = ((OSD::GetTime() - m_dwCaretTime) % 800) < 400;
+        DWORD dwPhase = (OSD::GetTime() - m_dwCaretTime) % 800;
+        bool fCaretOn = dwPhase < 400;
+
+        // Redraw when the caret next changes state
+        GUI::InvalidateAt(OSD::GetTime() + 400 - (dwPhase % 400));
         int dx = GetTextWidth(m_nViewOffset, m_nCaretEnd-m_nViewOffset);
 
         // Draw a character-height vertical bar after the text
@@ -1806,18 +1861,24 @@ void CListView::SetItems (CListViewItem* pItems_)
         delete m_pItems;
     }
 
+    m_pItems = pItems_;
+    UpdateLayout();
+
     if (pItems_)
-    {
-        // Count the number of items in the new list
-        for (m_nItems = 0, m_pItems = pItems_ ; pItems_ ; pItems_ = pItems_->m_pNext, m_nItems++);
+        Select(0);
+}
 
-        // Calculate how many items on a row, and how many rows, and set the required scrollbar size
-        m_nAcross = m_nWidth/ITEM_SIZE;
-        m_nDown = (m_nItems+m_nAcross-1) / m_nAcross;
-        m_pScrollBar->SetMaxPos(m_nDown*ITEM_SIZE);
+// Recalculate the item count and scrollbar range after the item list has changed
+void CListView::UpdateLayout ()
+{
+    // Count the number of items in the list
+    m_nItems = 0;
+    for (const CListViewItem* p = m_pItems ; p ; p = p->m_pNext, m_nItems++);
 
-        Select(0);
-    }
+    // Calculate how many items on a row, and how many rows, and set the required scrollbar size
+    m_nAcross = m_nWidth/ITEM_SIZE;
+    m_nDown = (m_nItems+m_nAcross-1) / m_nAcross;
+    m_pScrollBar->SetMaxPos(m_nDown*ITEM_SIZE);
 }
 
 void CListView::DrawItem (CScreen* pScreen_, int nItem_, int nX_, int nY_, const CListViewItem* pItem_)
@@ -2119,6 +2180,51 @@ static bool SortCompare (CListViewItem* p1_, CListViewItem* p2_)
     return SortCompare(p1_->m_pszLabel, p2_->m_pszLabel);
 }
 
+// Merge two sorted item lists, returning the head of the combined list
+static CListViewItem* MergeItems (CListViewItem* p1_, CListViewItem* p2_)
+{
+    CListViewItem *pHead = nullptr, **ppTail = &pHead;
+
+    while (p1_ && p2_)
+    {
+        // Take from the 2nd list only if it comes first, so equal entries keep their order
+        CListViewItem** pp = SortCompare(p1_, p2_) ? &p2_ : &p1_;
+        *ppTail = *pp;
+        ppTail = &(*pp)->m_pNext;
+        *pp = *ppTail;
+    }
+
+    *ppTail = p1_ ? p1_ : p2_;
+    return pHead;
+}
+
+// Merge sort a list of items, returning the new head
+static CListViewItem* SortItems (CListViewItem* pItems_)
+{
+    if (!pItems_ || !pItems_->m_pNext)
+        return pItems_;
+
+    // Find the middle of the list, using a second pointer moving at double speed
+    CListViewItem *pMid = pItems_, *pFast = pItems_->m_pNext;
+    while (pFast && (pFast = pFast->m_pNext))
+    {
+        pMid = pMid->m_pNext;
+        pFast = pFast->m_pNext;
+    }
+
+    // Split the list, sort each half, then merge them back together
+    CListViewItem* pSecond = pMid->m_pNext;
+    pMid->m_pNext = nullptr;
+
+    return MergeItems(SortItems(pItems_), SortItems(pSecond));
+}
+
+// Compressed files are opened by the background scan to check for disk images
+static bool IdentifyFile (const char* pcszFile_)
+{
+    return CFileView::GetFileIcon(pcszFile_) == &sCompressedIcon;
+}
+
 
 CFileView::CFileView (CWindow* pParent_, int nX_, int nY_, int nWidth_, int nHeight_)
     : CListView(pParent_, nX_, nY_, nWidth_, nHeight_)
@@ -2127,6 +2233,7 @@ CFileView::CFileView (CWindow* pParent_, int nX_, int nY_, int nWidth_, int nHei
 
 CFileView::~CFileView()
 {
+    delete m_pScan;
     delete[] m_pszPath;
     delete[] m_pszFilter;
 }
@@ -2136,6 +2243,10 @@ bool CFileView::OnMessage (int nMessage_, int nParam1_, int nParam2_)
 {
     bool fRet = CListView::OnMessage(nMessage_, nParam1_, nParam2_);
 
+    // Don't move the selection from under the user once they've made their own
+    if (fRet)
+        m_strSelect.clear();
+
     // Backspace moves up a directory
     if (!fRet && nMessage_ == GM_CHAR && nParam1_ == HK_BACKSPACE)
     {
@@ -2277,10 +2388,9 @@ void CFileView::SetPath (const char* pcszPath_)
         // Fill the file list
         Refresh();
 
-        // If we can find the file in the list, select it
-        int nItem;
-        if (pcszFile && (nItem = FindItem(pcszFile)) != -1)
-            Select(nItem);
+        // Select the file, if there was one
+        if (pcszFile && *pcszFile)
+            SelectItem(pcszFile);
     }
 }
 
@@ -2304,6 +2414,16 @@ void CFileView::ShowHidden (bool fShow_)
 }
 
 
+// Select an item by name, or once it's been listed if a scan is in progress
+void CFileView::SelectItem (const char* pcszLabel_)
+{
+    int nItem = FindItem(pcszLabel_);
+    if (nItem != -1)
+        Select(nItem);
+
+    m_strSelect = (nItem == -1 && m_pScan) ? pcszLabel_ : "";
+}
+
 // Populate the list view with items from the path matching the current file filter
 void CFileView::Refresh ()
 {
@@ -2315,7 +2435,10 @@ void CFileView::Refresh ()
     const CListViewItem* pItem = GetItem();
     char* pszLabel = pItem ? strdup(pItem->m_pszLabel) : nullptr;
 
-    // Free any existing list before we allocate a new one
+    // Abandon any scan in progress, and free the existing list before we start a new one
+    delete m_pScan;
+    m_pScan = nullptr;
+    m_mapFiles.clear();
     SetItems(nullptr);
     CListViewItem* pItems = nullptr;
 
@@ -2338,123 +2461,105 @@ void CFileView::Refresh ()
     }
     else
     {
-        DIR* dir = opendir(m_pszPath);
-        if (dir)
-        {
-            // Count the number of filter items to apply
-            int nFilters = *m_pszFilter ? 1 : 0;
-            char szFilters[256];
-            strncpy(szFilters, m_pszFilter, sizeof(szFilters)-1);
-            szFilters[sizeof(szFilters)-1] = '\0';
-
-            for (char* psz = strtok(szFilters, ";") ; psz && (psz = strtok(nullptr, ";")) ; nFilters++);
-
-            for (struct dirent* entry ; (entry = readdir(dir)) ; )
-            {
-                char sz[MAX_PATH];
-                struct stat st;
+        // List the directory in the background, with the entries added as they arrive
+        m_pScan = new CFileScan(m_pszPath, m_pszFilter, m_fShowHidden, IdentifyFile, OSD::MakeFilePath(MFP_SETTINGS, "imagetypes.idx"));
+        Invalidate();
 
-                // Ignore . and .. for now (we'll add .. back later if required)
-                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
-                    continue;
+        // If we're not a top-level directory, add a .. entry to the head of the list
+        // This prevents non-DOS/Win32 machines stepping back up to the device list level
+        if (strlen(m_pszPath) > 1)
+            pItems = new CListViewItem(&sFolderIcon, "..", pItems);
+    }
 
-                // Should we remove hidden files from the listing?
-                if (!m_fShowHidden)
-                {
-                    // Form the full path of the current file
-                    char szPath[MAX_PATH];
-                    strncpy(szPath , m_pszPath, MAX_PATH-1);
-                    szPath[MAX_PATH-1] = '\0';
-                    strncat(szPath, entry->d_name, MAX_PATH-strlen(szPath)-1);
-                    szPath[MAX_PATH-1] = '\0';
-
-                    // Skip the file if it's considered hidden
-                    if (OSD::IsHidden(szPath))
-                        continue;
-                }
+    // Give the item list to the list control
+    SetItems(pItems);
 
-                // Examine the entry to see what it is
-                strncpy(sz, m_pszPath, MAX_PATH-1);
-                sz[MAX_PATH-1] = '\0';
-                strncat(sz, entry->d_name, MAX_PATH-strlen(sz)-1);
+    // Was there a previous selection?
+    if (pszLabel)
+    {
+        // Select it now or when it's listed
+        SelectItem(pszLabel);
+        free(pszLabel);
+    }
+}
 
-                sz[MAX_PATH-1] = '\0';
+// Add any new results from the background scan to the list
+void CFileView::Update ()
+{
+    // Check for completion first, so we don't miss any final results
+    bool fDone = m_pScan->IsDone();
+    std::deque<SCAN_ENTRY> dEntries, dTypes;
 
-                // Skip if there's no entry to examine
-                if (stat(sz, &st) != 0)
-                    continue;
+    if (m_pScan->GetEntries(dEntries))
+    {
+        Invalidate();
 
-                // Only regular files are affected by the file filter
-                if (S_ISREG(st.st_mode))
-                {
-                    // If we have a filter list, apply it now
-                    if (nFilters)
-                    {
-                        int i;
+        const CListViewItem* pSelected = GetItem();
+        CListViewItem* pNew = nullptr;
 
-                        // Ignore files with no extension
-                        char* pszExt = strrchr(entry->d_name, '.');
-                        if (!pszExt)
-                            continue;
+        for (auto &sEntry : dEntries)
+        {
+            pNew = new CListViewItem(sEntry.fDir ? &sFolderIcon : sEntry.fDevice ? &sMiscIcon :
+                                     GetFileIcon(sEntry.strName.c_str()), sEntry.strName.c_str(), pNew);
 
-                        // Compare the extension with each of the filters
-                        char* pszFilter = szFilters;
-                        for (i = 0 ; i < nFilters && strcasecmp(pszFilter, pszExt) ; i++, pszFilter += strlen(pszFilter)+1);
+            if (!sEntry.fDir && !sEntry.fDevice)
+                m_mapFiles[sEntry.strName] = pNew;
+        }
 
-                        // Ignore the entry if we didn't match it
-                        if (i == nFilters)
-                            continue;
-                    }
-                }
+        // Sort the new entries and merge them into the list, keeping any .. entry at the head
+        CListViewItem** ppList = (m_pItems && !strcmp(m_pItems->m_pszLabel, "..")) ? &m_pItems->m_pNext : &m_pItems;
+        *ppList = MergeItems(*ppList, SortItems(pNew));
+        UpdateLayout();
 
-                // Ignore anything that isn't a directory or a block device (or a symbolic link to one)
-                else if (!S_ISDIR(st.st_mode) && !S_ISBLK(st.st_mode))
-                    continue;
+        // Keep the same item selected, wherever it has moved to
+        int nItem = 0;
+        for (const CListViewItem* p = m_pItems ; p && p != pSelected ; p = p->m_pNext, nItem++);
 
-                // Create a new list entry for the current item
-                CListViewItem* pNew = new CListViewItem(S_ISDIR(st.st_mode) ? &sFolderIcon :
-                                                        S_ISBLK(st.st_mode) ? &sMiscIcon :
-                                                        GetFileIcon(entry->d_name), entry->d_name);
+        if (pSelected)
+            m_nSelected = nItem;
+        else
+            Select(0);
 
-                // Insert the item into the correct sort position
-                CListViewItem *p = pItems, *pPrev = nullptr;
-                while (p && SortCompare(pNew, p))
-                {
-                    pPrev = p;
-                    p = p->m_pNext;
-                }
+        m_nHoverItem = -1;
+    }
 
-                // Adjust the links to any neighbouring entries
-                if (pPrev) pPrev->m_pNext = pNew;
-                pNew->m_pNext = p;
-                if (pItems == p) pItems = pNew;
-            }
+    if (m_pScan->GetTypes(dTypes))
+    {
+        Invalidate();
 
-            closedir(dir);
+        // Show compressed files holding a recognised image as disks
+        for (auto &sEntry : dTypes)
+        {
+            auto it = m_mapFiles.find(sEntry.strName);
+            if (it != m_mapFiles.end() && sEntry.nType != dtUnknown)
+                it->second->m_pIcon = &sDiskIcon;
         }
-
-        // If we're not a top-level directory, add a .. entry to the head of the list
-        // This prevents non-DOS/Win32 machines stepping back up to the device list level
-        if (strlen(m_pszPath) > 1)
-            pItems = new CListViewItem(&sFolderIcon, "..", pItems);
     }
 
-    // Give the item list to the list control
-    SetItems(pItems);
-
-    // Was there a previous selection?
-    if (pszLabel)
+    // Select any item we've been waiting for
+    int nItem;
+    if (!m_strSelect.empty() && (nItem = FindItem(m_strSelect.c_str())) != -1)
     {
-        // Look for it in the new list
-        int nItem = FindItem(pszLabel);
-        free(pszLabel);
+        Select(nItem);
+        m_strSelect.clear();
+    }
 
-        // If found, select it
-        if (nItem != -1)
-            Select(nItem);
+    if (fDone)
+    {
+        delete m_pScan;
+        m_pScan = nullptr;
+        m_strSelect.clear();
     }
 }
 
+void CFileView::OnIdle ()
+{
+    // Collect any results from a scan in progress
+    if (m_pScan)
+        Update();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CIconControl::CIconControl (CWindow* pParent_, int nX_, int nY_, const GUI_ICON* pIcon_)
@@ -55,11 +55,21 @@ class GUI
         static void Stop ();
 
         static void Draw (CScreen* pScreen_);
+        static void Idle ();
         static bool SendMessage (int nMessage_, int nParam1_=0, int nParam2_=0);
         static void Delete (CWindow* pWindow_);
 
+        static bool IsDirty ();
+        static void Invalidate () { s_fDirty = true; }
+        static void InvalidateAt (DWORD dwTime_);
+
+    protected:
+        static void IdleRecurse (CWindow* pWindow_);
+
     protected:
         static CWindow *s_pGUI;
+        static bool s_fDirty;
+        static DWORD s_dwRedrawTime;
         static std::queue<CWindow *> s_garbageQueue;
         static std::stack<CWindow*> s_dialogStack;
         static int s_nX, s_nY;
@@ -103,7 +113,8 @@ class CWindow
 
         void SetParent (CWindow* pParent_);
         void Destroy ();
-        void Enable (bool fEnable_=true) { m_fEnabled = fEnable_; }
+        void Invalidate () { GUI::Invalidate(); }
+        void Enable (bool fEnable_=true) { m_fEnabled = fEnable_; Invalidate(); }
         void Move (int nX_, int nY_);
         void Offset (int ndX_, int ndY_);
         void SetSize (int nWidth_, int nHeight_);
@@ -116,7 +127,7 @@ class CWindow
         virtual const GUIFONT *GetFont () const { return m_pFont; }
         virtual UINT GetValue () const;
         virtual void SetText (const char* pcszText_);
-        virtual void SetFont (const GUIFONT *pFont_) { m_pFont = pFont_; }
+        virtual void SetFont (const GUIFONT *pFont_) { m_pFont = pFont_; Invalidate(); }
         virtual void SetValue (UINT u_);
 
         virtual void Activate ();
@@ -127,6 +138,7 @@ class CWindow
         virtual void NotifyParent (int nParam_=0);
         virtual void OnNotify (CWindow* /*pWindow_*/, int /*nParam_*/) { }
         virtual bool OnMessage (int nMessage_, int nParam1_=0, int nParam2_=0);
+        virtual void OnIdle () { }
 
     protected:
         void RemoveChild ();
@@ -445,6 +457,9 @@ class CListView : public CWindow
 
         virtual void DrawItem (CScreen* pScreen_, int nItem_, int nX_, int nY_, const CListViewItem* pItem_);
 
+    protected:
+        void UpdateLayout ();
+
     protected:
         int m_nItems = 0, m_nSelected = 0, m_nHoverItem = 0;
         int m_nAcross = 0, m_nDown = 0, m_nItemOffset = 0;
@@ -499,6 +514,8 @@ class CMessageBox : public CDialog
         CIconControl* m_pIcon = nullptr;
 };
 
+class CFileScan;
+
 class CFileView : public CListView
 {
     public:
@@ -518,13 +535,22 @@ class CFileView : public CListView
         void Refresh ();
         void NotifyParent (int nParam_) override;
         bool OnMessage (int nMessage_, int nParam1_, int nParam2_) override;
+        void OnIdle () override;
 
         static const GUI_ICON* GetFileIcon (const char* pcszFile_);
 
+    protected:
+        void Update ();
+        void SelectItem (const char* pcszLabel_);
+
     protected:
         char *m_pszPath = nullptr;
         char *m_pszFilter = nullptr;
         bool m_fShowHidden = false;
+
+        CFileScan *m_pScan = nullptr;                       // Background scan of the current path, while in progress
+        std::map<std::string, CListViewItem*> m_mapFiles;   // Listed files, to apply identified types
+        std::string m_strSelect;                            // Item to select once the scan lists it
 };
 
 
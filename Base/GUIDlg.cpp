@@ -718,11 +718,13 @@ class CDisplayOptions final : public CDialog
 };
 
 
+static const int anSampleRates[] = { 22050, 44100, 48000, 96000 };
+
 class CSoundOptions final : public CDialog
 {
     public:
         CSoundOptions (CWindow* pParent_)
-            : CDialog(pParent_, 300, 193, "Sound Settings")
+            : CDialog(pParent_, 300, 243, "Sound Settings")
         {
             new CIconControl(this, 10, 10, &sSoundIcon);
 
@@ -739,11 +741,29 @@ class CSoundOptions final : public CDialog
             new CTextControl(this, 63, 104, "These devices use the same I/O port, so only\none may be connected at a time.");
             m_pDAC7C = new CComboBox(this, 63, 136, "None|Blue Alpha Sampler (8-bit mono)|SAMVox (4 channel 8-bit mono)|Paula (2 channel 4-bit stereo)", 190);
 
+
+            new CFrameControl(this, 50, 176, 238, 40, WHITE);
+            new CTextControl(this, 60, 172, "Output", YELLOW_8, BLUE_2);
+
+            new CTextControl(this, 63, 193, "Sample rate:");
+            m_pSampleRate = new CComboBox(this, 140, 190, "22050 Hz|44100 Hz (Default)|48000 Hz|96000 Hz", 125);
+
+            m_pSAABlip = new CCheckBox(this, 10, m_nHeight-19, "Band-limited SAA");
+
             m_pOK = new CTextButton(this, m_nWidth - 117, m_nHeight-21, "OK", 50);
             m_pCancel = new CTextButton(this, m_nWidth - 62, m_nHeight-21, "Cancel", 50);
 
             m_pSID->Select(GetOption(sid));
             m_pDAC7C->Select(GetOption(dac7c));
+
+            m_pSampleRate->Select(1);
+            for (int i = 0 ; i < static_cast<int>(_countof(anSampleRates)) ; i++)
+            {
+                if (GetOption(samplerate) == anSampleRates[i])
+                    m_pSampleRate->Select(i);
+            }
+
+            m_pSAABlip->SetChecked(GetOption(saablip));
         }
         CSoundOptions (const CSoundOptions &) = delete;
         void operator= (const CSoundOptions &) = delete;
@@ -757,6 +777,11 @@ class CSoundOptions final : public CDialog
             {
                 SetOption(sid, m_pSID->GetSelected());
                 SetOption(dac7c, m_pDAC7C->GetSelected());
+                SetOption(saablip, m_pSAABlip->IsChecked());
+                SetOption(samplerate, anSampleRates[m_pSampleRate->GetSelected()]);
+
+                if (Changed(samplerate))
+                    Sound::Init();
 
                 Destroy();
             }
@@ -765,6 +790,8 @@ class CSoundOptions final : public CDialog
     protected:
         CComboBox *m_pSID = nullptr;
         CComboBox *m_pDAC7C = nullptr;
+        CComboBox *m_pSampleRate = nullptr;
+        CCheckBox *m_pSAABlip = nullptr;
         CTextButton *m_pOK = nullptr;
         CTextButton *m_pCancel = nullptr;
 };
@@ -906,7 +933,7 @@ class CDriveOptions final : public CDialog
 {
     public:
         CDriveOptions (CWindow* pParent_)
-            : CDialog(pParent_, 300, 221, "Drive Settings")
+            : CDialog(pParent_, 300, 242, "Drive Settings")
         {
             new CIconControl(this, 10, 10, &sHardDiskIcon);
 
@@ -919,17 +946,19 @@ class CDriveOptions final : public CDialog
             new CTextControl(this, 158, 32, "D2:");
             m_pDrive2 = new CComboBox(this, 178, 29, "None|Floppy|Atom (Legacy)|Atom Lite", 100);
 
-            new CFrameControl(this, 50, 71, 238, 120);
+            new CFrameControl(this, 50, 71, 238, 141);
             new CTextControl(this, 60, 67, "Options", YELLOW_8, BLUE_2);
 
             m_pTurboDisk = new CCheckBox(this, 60, 87, "Fast floppy disk access");
 
-            m_pAutoLoad = new CCheckBox(this, 60, 108, "Auto-load media inserted at startup screen");
+            m_pDiskTraps = new CCheckBox(this, 60, 108, "Instant DOS sector transfers");
+
+            m_pAutoLoad = new CCheckBox(this, 60, 129, "Auto-load media inserted at startup screen");
 
-            m_pDosBoot = new CCheckBox(this, 60, 129, "Automagically boot non-bootable disks");
-            m_pDosBootText = new CTextControl(this, 77, 148, "DOS image (blank for SAMDOS 2.2):");
-            m_pDosDisk = new CEditControl(this, 77, 164, 182);
-            m_pBrowse = new CTextButton(this, 262, 164, "...", 17);
+            m_pDosBoot = new CCheckBox(this, 60, 150, "Automagically boot non-bootable disks");
+            m_pDosBootText = new CTextControl(this, 77, 169, "DOS image (blank for SAMDOS 2.2):");
+            m_pDosDisk = new CEditControl(this, 77, 185, 182);
+            m_pBrowse = new CTextButton(this, 262, 185, "...", 17);
 
             m_pOK = new CTextButton(this, m_nWidth - 117, m_nHeight-21, "OK", 50);
             m_pCancel = new CTextButton(this, m_nWidth - 62, m_nHeight-21, "Cancel", 50);
@@ -938,6 +967,7 @@ class CDriveOptions final : public CDialog
             m_pDrive1->Select(GetOption(drive1));
             m_pDrive2->Select(GetOption(drive2));
             m_pTurboDisk->SetChecked(GetOption(turbodisk) != 0);
+            m_pDiskTraps->SetChecked(GetOption(disktraps));
             m_pAutoLoad->SetChecked(GetOption(autoload) != 0);
             m_pDosBoot->SetChecked(GetOption(dosboot) != 0);
             m_pDosDisk->SetText(GetOption(dosdisk));
@@ -961,6 +991,7 @@ class CDriveOptions final : public CDialog
                 SetOption(drive2, anDriveTypes[m_pDrive2->GetSelected()]);
 
                 SetOption(turbodisk, m_pTurboDisk->IsChecked());
+                SetOption(disktraps, m_pDiskTraps->IsChecked());
                 SetOption(autoload, m_pAutoLoad->IsChecked());
 
                 SetOption(dosboot, m_pDosBoot->IsChecked());
@@ -1006,6 +1037,7 @@ class CDriveOptions final : public CDialog
         CComboBox *m_pDrive1 = nullptr;
         CComboBox *m_pDrive2 = nullptr;
         CCheckBox *m_pTurboDisk = nullptr;
+        CCheckBox *m_pDiskTraps = nullptr;
         CCheckBox *m_pAutoLoad = nullptr;
         CCheckBox *m_pDosBoot = nullptr;
         CEditControl *m_pDosDisk = nullptr;
@@ -26,12 +26,30 @@
 #include "HardDisk.h"
 #include "IDEDisk.h"
 
+#include <fcntl.h>
+
+static bool fWriteFailed;                   // Failure to report from the main thread
+static char szFailedFile[MAX_PATH];
+
 
 CHardDisk::CHardDisk (const char* path)
 : m_strPath(path)
 {
 }
 
+// Fetch the name of a disk that failed to save changes, if any, clearing the error
+/*static*/ bool CHardDisk::GetWriteError (char* pszFile_, size_t uLen_)
+{
+    if (!fWriteFailed)
+        return false;
+
+    strncpy(pszFile_, szFailedFile, uLen_-1);
+    pszFile_[uLen_-1] = '\0';
+    fWriteFailed = false;
+
+    return true;
+}
+
 bool CHardDisk::IsSDIDEDisk ()
 {
     // Check for the HDOS free space file-info-block in sector 1
@@ -138,7 +156,8 @@ bool CHDFHardDisk::Create (UINT uTotalSectors_)
 {
     bool fRet = false;
 
-    Close();
+    if (!Close())
+        return false;
 
     // No filename?
     if (m_strPath.empty())
@@ -181,19 +200,28 @@ bool CHDFHardDisk::Create (UINT uTotalSectors_)
 
 bool CHDFHardDisk::Open (bool fReadOnly_/*=false*/)
 {
-    Close();
+    if (!Close())
+        return false;
 
     // No disk?
     if (m_strPath.empty())
         return false;
 
-    // Open read-write, falling back on read-only (not ideal!)
-    if ((!fReadOnly_ && (m_hfDisk = fopen(m_strPath.c_str(), "r+b"))) || (m_hfDisk = fopen(m_strPath.c_str(), "rb")))
+    // With overlays the image itself is only read, otherwise open read-write, falling back on read-only (not ideal!)
+    bool fOverlay = !fReadOnly_ && COverlay::IsEnabled();
+    m_fReadOnly = fReadOnly_;
+    if (fReadOnly_ || fOverlay || (m_hDisk = open(m_strPath.c_str(), O_RDWR|O_BINARY)) < 0)
+    {
+        m_hDisk = open(m_strPath.c_str(), O_RDONLY|O_BINARY);
+        m_fReadOnly = !fOverlay;
+    }
+
+    if (IsOpen())
     {
         RS_IDE sHeader;
 
         // Read and check the header is valid/supported
-        if (fread(&sHeader, 1, sizeof(sHeader), m_hfDisk) != sizeof(sHeader) || (sHeader.bFlags & 3) ||
+        if (ReadAt(m_hDisk, 0, &sHeader, sizeof(sHeader)) != sizeof(sHeader) || (sHeader.bFlags & 3) ||
             memcmp(sHeader.szSignature, "RS-IDE", sizeof(sHeader.szSignature)))
             TRACE("!!! Invalid or incompatible HDF file\n");
         else
@@ -213,9 +241,9 @@ bool CHDFHardDisk::Open (bool fReadOnly_/*=false*/)
                 uIdentifyLen = sizeof(m_sIdentify);
 
             // Read the identify data
-            if (m_uDataOffset < sizeof(sHeader) || fread(&m_sIdentify, 1, uIdentifyLen, m_hfDisk) != uIdentifyLen)
+            if (m_uDataOffset < sizeof(sHeader) || ReadAt(m_hDisk, sizeof(sHeader), &m_sIdentify, uIdentifyLen) != static_cast<int>(uIdentifyLen))
                 TRACE("HDF data offset is invalid!\n");
-            else if (fstat(fileno(m_hfDisk), &st) == 0)
+            else if (fstat(m_hDisk, &st) == 0)
             {
                 m_sGeometry.uTotalSectors = static_cast<UINT>((st.st_size-m_uDataOffset)/m_uSectorSize);
 
@@ -223,6 +251,18 @@ bool CHDFHardDisk::Open (bool fReadOnly_/*=false*/)
                 SetIdentifyData(&m_sIdentify);
             }
 
+            // Changes go to a sector overlay, or nowhere if that's not possible
+            if (fOverlay && !(m_pOverlay = COverlay::Open(m_strPath.c_str(), m_uSectorSize, m_sGeometry.uTotalSectors,
+                                                          static_cast<uint64_t>(m_sGeometry.uTotalSectors) * m_uSectorSize)))
+                m_fReadOnly = true;
+
+            // Allocate the block cache
+            m_pbCache = new BYTE[HDF_CACHE_BLOCKS * HDF_BLOCK_SECTORS * m_uSectorSize];
+            m_pbRead = new BYTE[HDF_READAHEAD_BLOCKS * HDF_BLOCK_SECTORS * m_uSectorSize];
+
+            for (UINT u = 0 ; u < HDF_CACHE_BLOCKS ; u++)
+                m_asBlocks[u].pb = m_pbCache + u * HDF_BLOCK_SECTORS * m_uSectorSize;
+
             return true;
         }
     }
@@ -231,23 +271,283 @@ bool CHDFHardDisk::Open (bool fReadOnly_/*=false*/)
     return false;
 }
 
-void CHDFHardDisk::Close ()
+// Write any cached changes and close the disk, keeping everything if the changes can't be written
+bool CHDFHardDisk::Close ()
+{
+    if (IsOpen() && !Flush())
+        return false;
+
+    Release();
+    return true;
+}
+
+// Close the disk, discarding any unwritten changes
+void CHDFHardDisk::Release ()
 {
     if (IsOpen())
     {
-        fclose(m_hfDisk);
-        m_hfDisk = nullptr;
+        close(m_hDisk);
+        m_hDisk = -1;
+    }
+
+    delete m_pOverlay, m_pOverlay = nullptr;
+
+    for (UINT u = 0 ; u < HDF_CACHE_BLOCKS ; u++)
+        m_asBlocks[u] = HDF_BLOCK();
+
+    m_mapBlocks.clear();
+    m_fDirty = m_fWriteFailed = false;
+
+    delete[] m_pbCache, m_pbCache = nullptr;
+    delete[] m_pbRead, m_pbRead = nullptr;
+}
+
+// Write all cached changes to the HDF, in disk order
+bool CHDFHardDisk::Flush ()
+{
+    bool fRet = true;
+
+    if (m_fDirty)
+    {
+        for (auto &it : m_mapBlocks)
+            fRet &= FlushBlock(it.second);
+
+        m_fDirty = !fRet;
+        m_uIdleFrames = 0;
+
+        // Report the first failure, but not the retries that follow it
+        if (!fRet && !m_fWriteFailed)
+        {
+            TRACE("!!! Failed to write cached changes to %s\n", m_strPath.c_str());
+            strncpy(szFailedFile, m_strPath.c_str(), sizeof(szFailedFile)-1);
+            fWriteFailed = true;
+        }
+
+        m_fWriteFailed = !fRet;
     }
+
+    return fRet;
+}
+
+// Write the changed sectors in a cached block, with each run of sectors in a single write
+bool CHDFHardDisk::FlushBlock (HDF_BLOCK* pBlock_)
+{
+    off_t lOffset = m_uDataOffset + static_cast<off_t>(pBlock_->uBlock) * HDF_BLOCK_SECTORS * m_uSectorSize;
+
+    for (UINT uStart = 0, uEnd ; uStart < HDF_BLOCK_SECTORS ; uStart = uEnd)
+    {
+        uEnd = uStart + 1;
+
+        if (!(pBlock_->dwDirty & (1U << uStart)))
+            continue;
+
+        while (uEnd < HDF_BLOCK_SECTORS && (pBlock_->dwDirty & (1U << uEnd)))
+            uEnd++;
+
+        if (m_pOverlay)
+        {
+            if (!m_pOverlay->Write(pBlock_->uBlock * HDF_BLOCK_SECTORS + uStart, uEnd - uStart, pBlock_->pb + uStart * m_uSectorSize))
+                return false;
+        }
+        else if (!WriteAt(m_hDisk, lOffset + uStart * m_uSectorSize, pBlock_->pb + uStart * m_uSectorSize, (uEnd - uStart) * m_uSectorSize))
+            return false;
+
+        pBlock_->dwDirty &= ~(((1U << (uEnd - uStart)) - 1) << uStart);
+    }
+
+    return true;
+}
+
+// Find a free cache slot, evicting the least recently used block if necessary
+HDF_BLOCK* CHDFHardDisk::FreeBlock ()
+{
+    HDF_BLOCK *pBlock = &m_asBlocks[0];
+
+    for (UINT u = 0 ; u < HDF_CACHE_BLOCKS && pBlock->fUsed ; u++)
+    {
+        if (!m_asBlocks[u].fUsed || m_asBlocks[u].dwLastUse < pBlock->dwLastUse)
+            pBlock = &m_asBlocks[u];
+    }
+
+    if (pBlock->fUsed)
+    {
+        // Changes must reach the disk before the block can be reused
+        if (pBlock->dwDirty && !FlushBlock(pBlock))
+            return nullptr;
+
+        m_mapBlocks.erase(pBlock->uBlock);
+        pBlock->fUsed = false;
+    }
+
+    return pBlock;
+}
+
+// Read a run of uncached blocks in one go, returning the number loaded
+UINT CHDFHardDisk::LoadBlocks (UINT uBlock_, UINT uBlocks_)
+{
+    UINT uBlockSize = HDF_BLOCK_SECTORS * m_uSectorSize;
+    UINT uTotalBlocks = (m_sGeometry.uTotalSectors + HDF_BLOCK_SECTORS-1) / HDF_BLOCK_SECTORS;
+    UINT u;
+
+    // Stop short of the end of the disk, and of any block we already hold (which may have changes)
+    uBlocks_ = std::min(uBlocks_, HDF_READAHEAD_BLOCKS);
+    for (u = 1 ; u < uBlocks_ && uBlock_+u < uTotalBlocks && !m_mapBlocks.count(uBlock_+u) ; u++);
+
+    off_t lOffset = m_uDataOffset + static_cast<off_t>(uBlock_) * uBlockSize;
+    int nRead = ReadAt(m_hDisk, lOffset, m_pbRead, u * uBlockSize);
+    UINT uSectors = (nRead > 0) ? static_cast<UINT>(nRead) / m_uSectorSize : 0;
+
+    for (u = 0 ; uSectors ; u++)
+    {
+        HDF_BLOCK *pBlock = FreeBlock();
+        if (!pBlock)
+            break;
+
+        pBlock->fUsed = true;
+        pBlock->uBlock = uBlock_ + u;
+        pBlock->uSectors = std::min(uSectors, HDF_BLOCK_SECTORS);
+        pBlock->dwDirty = 0;
+        pBlock->dwLastUse = ++m_dwLastUse;
+        memcpy(pBlock->pb, m_pbRead + u * uBlockSize, pBlock->uSectors * m_uSectorSize);
+
+        // Apply any changed sectors from the overlay
+        for (UINT i = 0 ; m_pOverlay && i < pBlock->uSectors ; i++)
+        {
+            UINT uSector = pBlock->uBlock * HDF_BLOCK_SECTORS + i;
+            if (m_pOverlay->HasChunk(uSector) && !m_pOverlay->Read(uSector, pBlock->pb + i * m_uSectorSize))
+                TRACE("!!! Failed to read sector %u from overlay\n", uSector);
+        }
+
+        m_mapBlocks[pBlock->uBlock] = pBlock;
+        uSectors -= pBlock->uSectors;
+    }
+
+    return u;
+}
+
+// Return the cached block, reading it (and any following blocks for sequential access) if needed
+HDF_BLOCK* CHDFHardDisk::CacheBlock (UINT uBlock_)
+{
+    auto it = m_mapBlocks.find(uBlock_);
+
+    if (it == m_mapBlocks.end())
+    {
+        if (!IsOpen() || !LoadBlocks(uBlock_, (uBlock_ == m_uNextBlock) ? HDF_READAHEAD_BLOCKS : 1))
+            return nullptr;
+
+        it = m_mapBlocks.find(uBlock_);
+    }
+
+    it->second->dwLastUse = ++m_dwLastUse;
+    m_uNextBlock = uBlock_ + 1;
+
+    return it->second;
 }
 
 bool CHDFHardDisk::ReadSector (UINT uSector_, BYTE* pb_)
 {
-    off_t lOffset = m_uDataOffset + static_cast<off_t>(uSector_) * m_uSectorSize;
-    return m_hfDisk && !fseek(m_hfDisk, lOffset, SEEK_SET) && (fread(pb_, 1, m_uSectorSize, m_hfDisk) == m_uSectorSize);
+    HDF_BLOCK *pBlock = CacheBlock(uSector_ / HDF_BLOCK_SECTORS);
+    UINT uIndex = uSector_ % HDF_BLOCK_SECTORS;
+
+    if (!pBlock || uIndex >= pBlock->uSectors)
+        return false;
+
+    memcpy(pb_, pBlock->pb + uIndex * m_uSectorSize, m_uSectorSize);
+    return true;
 }
 
 bool CHDFHardDisk::WriteSector (UINT uSector_, BYTE* pb_)
 {
-    off_t lOffset = m_uDataOffset + static_cast<off_t>(uSector_) * m_uSectorSize;
-    return m_hfDisk && !fseek(m_hfDisk, lOffset, SEEK_SET) && (fwrite(pb_, 1, m_uSectorSize, m_hfDisk) == m_uSectorSize);
+    if (m_fReadOnly)
+        return false;
+
+    HDF_BLOCK *pBlock = CacheBlock(uSector_ / HDF_BLOCK_SECTORS);
+    UINT uIndex = uSector_ % HDF_BLOCK_SECTORS;
+
+    if (!pBlock || uIndex >= pBlock->uSectors)
+        return false;
+
+    // Update the cache, leaving the write until the disk is idle
+    memcpy(pBlock->pb + uIndex * m_uSectorSize, pb_, m_uSectorSize);
+    pBlock->dwDirty |= (1U << uIndex);
+
+    m_fDirty = true;
+    m_uIdleFrames = 0;
+    return true;
+}
+
+// Fetch the uncached blocks for a multi-sector read using as few reads as possible
+void CHDFHardDisk::PrefetchSectors (UINT uSector_, UINT uCount_)
+{
+    UINT uBlock = uSector_ / HDF_BLOCK_SECTORS;
+    UINT uEnd = (uSector_ + uCount_ - 1) / HDF_BLOCK_SECTORS;
+
+    while (IsOpen() && uBlock <= uEnd)
+    {
+        if (m_mapBlocks.count(uBlock))
+            uBlock++;
+        else
+        {
+            UINT uLoaded = LoadBlocks(uBlock, uEnd - uBlock + 1);
+            if (!uLoaded)
+                break;
+
+            uBlock += uLoaded;
+        }
+    }
+}
+
+void CHDFHardDisk::FrameEnd ()
+{
+    // Write changes once the disk has been idle for a while, retrying later on failure
+    if (m_fDirty && ++m_uIdleFrames >= HDF_FLUSH_FRAMES)
+        Flush();
+}
+
+
+bool CHDFHardDisk::HasOverlay () const
+{
+    return m_pOverlay != nullptr;
+}
+
+// Write the overlay changes to the disk image, leaving an empty overlay
+bool CHDFHardDisk::CommitOverlay ()
+{
+    if (!m_pOverlay || !Flush())
+        return false;
+    else if (m_pOverlay->IsEmpty())
+        return true;
+
+    int hDisk = open(m_strPath.c_str(), O_RDWR|O_BINARY);
+    if (hDisk < 0)
+        return false;
+
+    bool fRet = true;
+
+    for (uint64_t u = m_pOverlay->NextChunk(0) ; fRet && u < m_pOverlay->GetChunks() ; u = m_pOverlay->NextChunk(u+1))
+    {
+        fRet = m_pOverlay->Read(u, m_pbRead) &&
+               WriteAt(hDisk, m_uDataOffset + static_cast<off_t>(u) * m_uSectorSize, m_pbRead, m_uSectorSize);
+    }
+
+    close(hDisk);
+
+    // The image now holds everything, so the overlay can start afresh
+    return fRet && m_pOverlay->Reset();
+}
+
+// Throw away all changes since the overlay was last committed
+bool CHDFHardDisk::DiscardOverlay ()
+{
+    if (!m_pOverlay)
+        return false;
+
+    // Forget cached blocks, including unwritten changes
+    for (UINT u = 0 ; u < HDF_CACHE_BLOCKS ; u++)
+        m_asBlocks[u].fUsed = false, m_asBlocks[u].dwDirty = 0;
+
+    m_mapBlocks.clear();
+    m_fDirty = false;
+
+    return m_pOverlay->Reset();
 }
@@ -23,9 +23,27 @@
 
 #include "IO.h"
 #include "ATA.h"
+#include "Overlay.h"
 
 const unsigned int HDD_ACTIVE_FRAMES = 2;    // Frames the HDD is considered active after a command
 
+const UINT HDF_BLOCK_SECTORS = 16;          // Sectors in each HDF cache block
+const UINT HDF_CACHE_BLOCKS = 256;          // Blocks held in the HDF cache (2MB)
+const UINT HDF_READAHEAD_BLOCKS = 4;        // Most blocks fetched by a single read
+const UINT HDF_FLUSH_FRAMES = 25;           // Idle frames before cached writes are flushed to the HDF
+
+
+typedef struct
+{
+    bool fUsed;             // Slot holds a block?
+    UINT uBlock;            // Block number
+    UINT uSectors;          // Valid sectors, which may be fewer at the end of the disk
+    DWORD dwDirty;          // Bitmask of sectors changed since the last flush
+    DWORD dwLastUse;        // Access stamp for LRU replacement
+    BYTE *pb;               // Block data
+}
+HDF_BLOCK;
+
 
 class CHardDisk : public CATADevice
 {
@@ -40,6 +58,12 @@ class CHardDisk : public CATADevice
         bool IsSDIDEDisk ();
         bool IsBDOSDisk (bool *pfByteSwapped=nullptr);
 
+        static bool GetWriteError (char* pszFile_, size_t uLen_);
+
+        virtual bool HasOverlay () const { return false; }
+        virtual bool CommitOverlay () { return false; }
+        virtual bool DiscardOverlay () { return false; }
+
     protected:
         std::string m_strPath;
 };
@@ -51,24 +75,51 @@ class CHDFHardDisk final : public CHardDisk
         CHDFHardDisk (const char* pcszDisk_);
         CHDFHardDisk (const CHDFHardDisk &) = delete;
         void operator= (const CHDFHardDisk &) = delete;
-        ~CHDFHardDisk () { Close(); }
+        ~CHDFHardDisk () { Close(); Release(); }
 
     public:
         static bool Create (const char* pcszDisk_, UINT uTotalSectors_);
 
     public:
-        bool IsOpen () const { return m_hfDisk != nullptr; }
+        bool IsOpen () const { return m_hDisk >= 0; }
         bool Open (bool fReadOnly_=false) override;
         bool Create (UINT uTotalSectors_);
-        void Close ();
+        bool Close ();
+        bool Flush ();
 
         bool ReadSector (UINT uSector_, BYTE* pb_) override;
         bool WriteSector (UINT uSector_, BYTE* pb_) override;
+        void PrefetchSectors (UINT uSector_, UINT uCount_) override;
+        void FrameEnd () override;
+
+        bool HasOverlay () const override;
+        bool CommitOverlay () override;
+        bool DiscardOverlay () override;
+
+    protected:
+        HDF_BLOCK* CacheBlock (UINT uBlock_);
+        UINT LoadBlocks (UINT uBlock_, UINT uBlocks_);
+        HDF_BLOCK* FreeBlock ();
+        bool FlushBlock (HDF_BLOCK* pBlock_);
+        void Release ();
 
     protected:
-        FILE *m_hfDisk = nullptr;
+        int m_hDisk = -1;
+        bool m_fReadOnly = false;
         UINT m_uDataOffset = 0;
         UINT m_uSectorSize = 0;
+
+        HDF_BLOCK m_asBlocks[HDF_CACHE_BLOCKS] {};
+        std::map<UINT, HDF_BLOCK*> m_mapBlocks; // Cached blocks, by block number
+        BYTE *m_pbCache = nullptr;              // Data for all cache blocks
+        BYTE *m_pbRead = nullptr;               // Buffer for multi-block reads
+        DWORD m_dwLastUse = 0;
+        UINT m_uNextBlock = 0;                  // Block following the last one accessed, to spot sequential reads
+        UINT m_uIdleFrames = 0;                 // Frames since the last write
+        bool m_fDirty = false;                  // Cache holds unwritten changes?
+        bool m_fWriteFailed = false;            // Last flush failed, and has been reported
+
+        COverlay *m_pOverlay = nullptr;         // Private changes, leaving the image untouched
 };
 
 #endif // HARDDISK_H
@@ -250,6 +250,15 @@ void Exit (bool fReInit_/*=false*/)
         delete pAtom, pAtom = nullptr;
         delete pAtomLite, pAtomLite = nullptr;
         delete pSDIDE, pSDIDE = nullptr;
+
+        // Finish any disk changes still being written in the background
+        CDisk::WaitWrites();
+
+        char szFile[MAX_PATH];
+        if (CDisk::GetWriteError(szFile, sizeof(szFile)))
+            Message(msgWarning, "Failed to save changes to %s", szFile);
+        if (CHardDisk::GetWriteError(szFile, sizeof(szFile)))
+            Message(msgWarning, "Failed to save changes to %s", szFile);
     }
 }
 
@@ -926,12 +935,18 @@ void FrameUpdate ()
     pFloppy2->FrameEnd();
     pAtom->FrameEnd();
     pAtomLite->FrameEnd();
+    pSDIDE->FrameEnd();
     pPrinterFile->FrameEnd();
 
-    Input::Update();
+    // Report any disk changes that failed to save in the background
+    char szFile[MAX_PATH];
+    if (CDisk::GetWriteError(szFile, sizeof(szFile)))
+        Message(msgWarning, "Failed to save changes to %s", szFile);
+    if (CHardDisk::GetWriteError(szFile, sizeof(szFile)))
+        Message(msgWarning, "Failed to save changes to %s", szFile);
 
-    if (!g_nTurbo)
-        Sound::FrameUpdate();
+    Input::Update();
+    Sound::FrameUpdate();
 }
 
 void UpdateInput()
@@ -1110,4 +1125,140 @@ bool Rst48Hook ()
     return false;
 }
 
+
+// DOS sector transfer loop fragments, as used by SAMDOS and MasterDOS
+static const BYTE abLoopHead[] = { 0x0c, 0x0c, 0x0c };                   // inc c (x3) to the data port
+static const BYTE abLoopTail[] = { 0x0d, 0x0d, 0x0d };                   // dec c (x3) back to the status port
+static const BYTE abCounter[]  = { 0x1b, 0x7a, 0xb3, 0x20, 0x01, 0xd9 }; // dec de ; ld a,d ; or e ; jr nz,$+3 ; exx
+static const BYTE abPoll[]     = { 0xed, 0x78, 0xcb, 0x4f, 0x20 };       // in a,(c) ; bit 1,a ; jr nz,loop
+static const BYTE abBusy[]     = { 0xcb, 0x47, 0x20 };                   // bit 0,a ; jr nz,poll
+
+const int MAX_IDLE_POLLS = 64;      // Status reads without DRQ before we hand back to normal emulation
+
+static bool MatchCode (WORD wAddr_, const BYTE *pb_, size_t uLen_)
+{
+    while (uLen_--)
+    {
+        if (read_byte(wAddr_++) != *pb_++)
+            return false;
+    }
+
+    return true;
+}
+
+// Relative jump at the given address lands on the target?
+static bool JumpsTo (WORD wAddr_, WORD wTarget_)
+{
+    return static_cast<WORD>(wAddr_ + 1 + static_cast<signed char>(read_byte(wAddr_))) == wTarget_;
+}
+
+// Complete a DOS sector transfer loop in one go, starting from its INI/OUTI
+static bool DiskTransferHook (bool fWrite_)
+{
+    if (!GetOption(disktraps) || (C & 3) != regData)
+        return false;
+
+    // Only trap transfers to our own floppy emulation
+    if (!((C & FLOPPY_MASK) == FLOPPY1_BASE && GetOption(drive1) == drvFloppy) &&
+        !((C & FLOPPY_MASK) == FLOPPY2_BASE && GetOption(drive2) == drvFloppy))
+        return false;
+
+    // The transfer instruction must be surrounded by the port adjustments
+    WORD wStart = PC - 2 - sizeof(abLoopHead);
+    if (!MatchCode(wStart, abLoopHead, sizeof(abLoopHead)) || !MatchCode(PC, abLoopTail, sizeof(abLoopTail)))
+        return false;
+
+    // Reads may count down to a separate buffer for the last few bytes
+    WORD wPoll = PC + sizeof(abLoopTail);
+    bool fCounter = !fWrite_ && MatchCode(wPoll, abCounter, sizeof(abCounter));
+    if (fCounter)
+        wPoll += sizeof(abCounter);
+
+    // Unrolled DRQ polls back to the loop start, then a BUSY test back to the first poll
+    WORD wAddr = wPoll;
+    while (MatchCode(wAddr, abPoll, sizeof(abPoll)) && JumpsTo(wAddr + sizeof(abPoll), wStart))
+        wAddr += sizeof(abPoll) + 1;
+
+    if (wAddr == wPoll || !MatchCode(wAddr, abBusy, sizeof(abBusy)) || !JumpsTo(wAddr + sizeof(abBusy), wPoll))
+        return false;
+
+    WORD wExit = wAddr + sizeof(abBusy) + 1;
+    BYTE bStatusPort = C - 3;
+    DWORD dwBytes = 0;
+
+    for (;;)
+    {
+        // Transfer the current byte exactly as the instruction would
+        if (fWrite_)
+        {
+            B--;
+            Out(BC, read_byte(HL));
+        }
+        else
+        {
+            BYTE b = In(BC);
+            write_byte(HL, b);
+            B--;
+        }
+
+        HL++;
+        C -= 3;
+        dwBytes++;
+
+        if (fCounter && !--DE)
+        {
+            std::swap(BC,BC_);
+            std::swap(DE,DE_);
+            std::swap(HL,HL_);
+        }
+
+        // Anything unexpected is left to the code itself, from the first poll
+        if (C != bStatusPort)
+        {
+            PC = wPoll;
+            break;
+        }
+
+        int nIdle = 0;
+        do
+        {
+            A = In(BC);
+        }
+        while (!(A & DRQ) && (A & BUSY) && ++nIdle < MAX_IDLE_POLLS);
+
+        // More data to transfer?
+        if (A & DRQ)
+        {
+            C += 3;
+            continue;
+        }
+
+        // Continue normally if the controller is still busy
+        if (A & BUSY)
+        {
+            PC = wPoll;
+            break;
+        }
+
+        // Command complete, so leave the loop as the final BIT 0,A would
+        F = (F & FLAG_C) | FLAG_Z | FLAG_H | FLAG_P | (A & (FLAG_3|FLAG_5));
+        PC = wExit;
+        break;
+    }
+
+    // Charge any configured time for the transferred data
+    g_dwCycleCounter += dwBytes * GetOption(disktrapdelay);
+    return true;
+}
+
+bool IniHook ()
+{
+    return DiskTransferHook(false);
+}
+
+bool OutiHook ()
+{
+    return DiskTransferHook(true);
+}
+
 } // namespace IO
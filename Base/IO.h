@@ -56,6 +56,8 @@ namespace IO
     bool EiHook ();
     bool Rst8Hook ();
     bool Rst48Hook ();
+    bool IniHook ();
+    bool OutiHook ();
 }
 
 
@@ -102,6 +104,10 @@ class CDiskDevice :  public CIoDevice
 
         virtual void SetDiskModified (bool /*modified*/=true) { }
 
+        virtual bool HasOverlay () const { return false; }
+        virtual bool CommitOverlay () { return false; }
+        virtual bool DiscardOverlay () { return false; }
+
     protected:
         UINT m_uActive = 0; // active when non-zero, decremented by FrameEnd()
 };
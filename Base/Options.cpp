@@ -93,6 +93,8 @@ OPTION aOptions[] =
     OPT_N("Drive1",       drive1,         1),         // Floppy drive 1 present
     OPT_N("Drive2",       drive2,         1),         // Floppy drive 2 present
     OPT_N("TurboDisk",    turbodisk,      true),      // Accelerated disk access
+    OPT_F("DiskTraps",    disktraps,      false),     // Short-circuit DOS sector transfers, at the cost of accurate timing
+    OPT_N("DiskTrapDelay", disktrapdelay, 0),         // No extra T-states per byte transferred by disk traps
     OPT_F("SavePrompt",   saveprompt,     true),      // Prompt before saving changes
     OPT_F("DosBoot",      dosboot,        true),      // Automagically boot DOS from non-bootable disks
     OPT_S("DosDisk",      dosdisk,        ""),        // No override DOS disk, use internal SAMDOS 2.2
@@ -104,6 +106,7 @@ OPTION aOptions[] =
     OPT_S("AtomDisk0",    atomdisk0,      ""),        // No Atom disk 0
     OPT_S("AtomDisk1",    atomdisk1,      ""),        // No Atom disk 1
     OPT_S("SDIDEDisk",    sdidedisk,      ""),        // No SD IDE hard disk
+    OPT_S("OverlayPath",  overlaypath,    ""),        // No overlays, changes are written to the disk images
     OPT_S("Tape",         tape,           ""),        // No tape image
     OPT_F("AutoLoad",     autoload,       true),      // Auto-load media inserted at the startup screen
 
@@ -151,9 +154,14 @@ OPTION aOptions[] =
 
     OPT_F("Sound",        sound,          true),      // Sound enabled
     OPT_N("Latency",      latency,        3),         // Sound latency of 3 frames
+    OPT_N("SampleRate",   samplerate,     44100),     // Output sample rate of 44.1KHz
     OPT_N("DAC7C",        dac7c,          1),         // Blue Alpha Sampler on port &7c
     OPT_N("SamplerFreq",  samplerfreq,    18000),     // Blue Alpha clock frequency (default=18KHz)
     OPT_N("SID",          sid,            1),         // SID interface with MOS6581
+    OPT_F("SAABlip",      saablip,        false),     // Band-limited SAA output (default=point-sampled)
+    OPT_N("DACVolume",    dacvolume,      100),       // DAC output at full volume
+    OPT_N("SAAVolume",    saavolume,      100),       // SAA output at full volume
+    OPT_N("SIDVolume",    sidvolume,      100),       // SID output at full volume
 
     OPT_N("DriveLights",  drivelights,    1),         // Show drive activity lights
     OPT_F("Profile",      profile,        true),      // Show only emulation speed and framerate
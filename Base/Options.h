@@ -59,6 +59,8 @@ typedef struct
     int     drive1;                 // Drive 1 type
     int     drive2;                 // Drive 2 type
     bool    turbodisk;              // Accelerated disk access?
+    bool    disktraps;              // True to short-circuit DOS sector transfers, for a speed boost
+    int     disktrapdelay;          // Extra T-states charged per byte transferred by disk traps
     bool    saveprompt;             // Prompt before saving disk changes?
     bool    dosboot;                // Automagically boot DOS from non-bootable disks?
     char    dosdisk[MAX_PATH];      // Override DOS boot disk to use instead of the internal SAMDOS 2.2 image
@@ -73,6 +75,7 @@ typedef struct
     char    atomdisk0[MAX_PATH];    // Atom disk 0
     char    atomdisk1[MAX_PATH];    // Atom disk 1
     char    sdidedisk[MAX_PATH];    // Hard disk image for SD IDE interface
+    char    overlaypath[MAX_PATH];  // Directory for copy-on-write disk overlays, or empty to write to images
     char    tape[MAX_PATH];         // Tape image file
     bool    autoload;               // Auto-load media inserted at the startup screen?
 
@@ -119,9 +122,14 @@ typedef struct
 
     bool    sound;                  // Sound enabled?
     int     latency;                // Amount of sound buffering
+    int     samplerate;             // Output sample rate in Hz
     int     dac7c;                  // DAC device on shared port &7c? (0=none, 1=BlueAlpha Sampler, 2=SAMVox, 3=Paula)
     int     samplerfreq;            // Blue Alpha Sampler clock frequency
     int     sid;                    // SID chip type (0=none, 1=MOS6581, 2=MOS8580)
+    bool    saablip;                // Band-limited SAA output?
+    int     dacvolume;              // DAC, SAA and SID volume levels, as a percentage (0-400)
+    int     saavolume;
+    int     sidvolume;
 
     int     drivelights;            // Show floppy drive LEDs
     bool    profile;                // Show profile stats?
@@ -0,0 +1,369 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Overlay.cpp: Copy-on-write overlay files for disk images
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  An overlay holds private changes to a disk image that is only ever read,
+//  so many instances can share one base image. The overlay is a header, a
+//  bitmap with one bit per chunk (sector), and a sparse data area with each
+//  chunk at a fixed position, so only changed chunks take any space.
+//
+//  Chunk data is written before its bitmap bit, so an interrupted write
+//  leaves the chunk reading from the base image.
+//
+//  Overlays live in the OverlayPath directory, named after the base image.
+//  The base size and modification time are recorded. If the base image has
+//  since changed, such as from another instance committing its overlay, any
+//  changes in the stale overlay are moved aside and the user is told.
+//
+//  Each overlay is locked by the instance using it. Other instances using
+//  the same base image get their own overlay, numbered after the first.
+
+#include "SimCoupe.h"
+#include "Overlay.h"
+
+#include "Options.h"
+#include "Util.h"
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <winioctl.h>
+#else
+#include <sys/file.h>
+#endif
+
+static const char OVERLAY_SIGNATURE[] = "SIMCOVL\x1a";
+const int MAX_OVERLAY_INSTANCES = 16;   // Instances that can share a base image, each with its own overlay
+
+
+// Take an exclusive lock on an open file, failing if another process holds it
+static bool LockOverlay (int hFile_)
+{
+#ifdef _WIN32
+    OVERLAPPED ov {};
+    return !!LockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(hFile_)), LOCKFILE_EXCLUSIVE_LOCK|LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD, &ov);
+#else
+    return !flock(hFile_, LOCK_EX|LOCK_NB);
+#endif
+}
+
+// Mark the file as sparse, so unwritten chunks take no space (other platforms do this anyway)
+static void SetSparse (int hFile_)
+{
+#ifdef _WIN32
+    DWORD dwReturned;
+    DeviceIoControl(reinterpret_cast<HANDLE>(_get_osfhandle(hFile_)), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &dwReturned, nullptr);
+#else
+    (void)hFile_;
+#endif
+}
+
+static bool TruncateOverlay (int hFile_)
+{
+#ifdef _WIN32
+    return !_chsize_s(hFile_, 0);
+#else
+    return !ftruncate(hFile_, 0);
+#endif
+}
+
+
+COverlay::COverlay (const char* pcszPath_, const char* pcszBase_)
+    : m_strPath(pcszPath_), m_strBase(pcszBase_)
+{
+}
+
+COverlay::~COverlay ()
+{
+    if (m_hFile >= 0)
+        close(m_hFile);
+
+    delete[] m_pbBitmap;
+}
+
+
+/*static*/ bool COverlay::IsEnabled ()
+{
+    return *GetOption(overlaypath) != '\0';
+}
+
+// Open the overlay for a base image, creating a fresh one if there's no usable existing overlay
+/*static*/ COverlay* COverlay::Open (const char* pcszBase_, UINT uChunkSize_, uint64_t ullChunks_, uint64_t ullSize_)
+{
+    if (!IsEnabled() || !pcszBase_ || !*pcszBase_)
+        return nullptr;
+
+    const char* pcszDir = GetOption(overlaypath);
+    const char* pcszName = strrchr(pcszBase_, PATH_SEPARATOR);
+    pcszName = pcszName ? pcszName+1 : pcszBase_;
+
+    // Include a checksum of the full path to keep images with the same name apart
+    char szPath[MAX_PATH], szSep[2] = { PATH_SEPARATOR, '\0' };
+    if (pcszDir[strlen(pcszDir)-1] == PATH_SEPARATOR)
+        szSep[0] = '\0';
+
+    DWORD dwCrc = CrcBlock(pcszBase_, strlen(pcszBase_));
+
+    // Use the first overlay not locked by another instance
+    for (int i = 0 ; i < MAX_OVERLAY_INSTANCES ; i++)
+    {
+        if (!i)
+            snprintf(szPath, sizeof(szPath), "%s%s%s-%04X.ovl", pcszDir, szSep, pcszName, dwCrc);
+        else
+            snprintf(szPath, sizeof(szPath), "%s%s%s-%04X-%d.ovl", pcszDir, szSep, pcszName, dwCrc, i);
+
+        COverlay* pOverlay = new COverlay(szPath, pcszBase_);
+
+        if (!pOverlay->Lock())
+            TRACE("Overlay %s is in use\n", szPath);
+        else
+        {
+            int nLoad = pOverlay->Load(uChunkSize_, ullChunks_);
+
+            if (nLoad == overlayValid)
+            {
+                TRACE("Using overlay %s with %u changed chunks\n", szPath, static_cast<UINT>(pOverlay->m_ullUsed));
+                return pOverlay;
+            }
+
+            // Never throw away changes, so keep a stale overlay and start a new one in its place
+            if (nLoad == overlayEmpty || (pOverlay->MoveAside() && pOverlay->Lock()))
+            {
+                if (pOverlay->Create(uChunkSize_, ullChunks_, ullSize_))
+                    return pOverlay;
+
+                TRACE("!!! Failed to create overlay %s\n", szPath);
+                delete pOverlay;
+                return nullptr;
+            }
+        }
+
+        delete pOverlay;
+    }
+
+    return nullptr;
+}
+
+
+// Fetch the base image details that an overlay must match
+bool COverlay::GetBaseDetails (uint64_t* pullSize_, int64_t* pllTime_) const
+{
+    struct stat st;
+    if (stat(m_strBase.c_str(), &st))
+        return false;
+
+    *pullSize_ = static_cast<uint64_t>(st.st_size);
+    *pllTime_ = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+off_t COverlay::GetDataOffset () const
+{
+    off_t lOffset = sizeof(OVERLAY_HEADER) + GetBitmapSize();
+    return (lOffset + OVERLAY_ALIGN-1) & ~static_cast<off_t>(OVERLAY_ALIGN-1);
+}
+
+
+// Open the overlay file and lock it for our exclusive use, creating it if necessary
+bool COverlay::Lock ()
+{
+    if ((m_hFile = open(m_strPath.c_str(), O_RDWR|O_CREAT|O_BINARY, 0644)) < 0)
+        return false;
+
+    if (LockOverlay(m_hFile))
+    {
+        SetSparse(m_hFile);
+        return true;
+    }
+
+    close(m_hFile);
+    m_hFile = -1;
+    return false;
+}
+
+// Load an existing overlay, returning whether it's empty, stale (unusable but holding changes), or valid
+int COverlay::Load (UINT uChunkSize_, uint64_t ullChunks_)
+{
+    uint64_t ullBaseSize;
+    int64_t llBaseTime;
+
+    int nRead = ReadAt(m_hFile, 0, &m_sHeader, sizeof(m_sHeader));
+    if (!nRead)
+        return overlayEmpty;
+    else if (nRead != sizeof(m_sHeader) ||
+        memcmp(m_sHeader.szSignature, OVERLAY_SIGNATURE, sizeof(m_sHeader.szSignature)) ||
+        m_sHeader.dwVersion != OVERLAY_VERSION || !m_sHeader.dwChunkSize)
+    {
+        TRACE("!!! Invalid overlay file %s\n", m_strPath.c_str());
+        return overlayStale;
+    }
+
+    size_t uBitmap = GetBitmapSize();
+    m_pbBitmap = new BYTE[uBitmap];
+
+    // The bitmap may be short if the tail has never been written, so the remainder is clear
+    if ((nRead = ReadAt(m_hFile, sizeof(m_sHeader), m_pbBitmap, static_cast<UINT>(uBitmap))) < 0)
+        return overlayStale;
+
+    memset(m_pbBitmap + nRead, 0, uBitmap - nRead);
+
+    for (uint64_t u = 0 ; u < m_sHeader.ullChunks ; u++)
+        m_ullUsed += HasChunk(u);
+
+    if (!GetBaseDetails(&ullBaseSize, &llBaseTime) || ullBaseSize != m_sHeader.ullBaseSize || llBaseTime != m_sHeader.llBaseTime ||
+        m_sHeader.dwChunkSize != uChunkSize_ || m_sHeader.ullChunks != ullChunks_)
+    {
+        // An unchanged overlay has nothing worth keeping
+        TRACE("Overlay %s doesn't match the base image\n", m_strPath.c_str());
+        return m_ullUsed ? overlayStale : overlayEmpty;
+    }
+
+    return overlayValid;
+}
+
+// Rename a stale overlay so its changes aren't lost, and tell the user where they went
+bool COverlay::MoveAside ()
+{
+    char szStale[MAX_PATH];
+    struct stat st;
+
+    // Release the file first, as Windows can't rename it while it's open
+    close(m_hFile);
+    m_hFile = -1;
+
+    for (int i = 1 ; i < 100 ; i++)
+    {
+        snprintf(szStale, sizeof(szStale), "%s.%d.old", m_strPath.c_str(), i);
+
+        // Never replace an earlier stale overlay
+        if (!stat(szStale, &st))
+            continue;
+
+        if (rename(m_strPath.c_str(), szStale))
+            break;
+
+        Message(msgWarning, "%s has changed, so changes made to the old image were moved to %s", m_strBase.c_str(), szStale);
+        return true;
+    }
+
+    TRACE("!!! Failed to move stale overlay %s aside\n", m_strPath.c_str());
+    return false;
+}
+
+// Start an empty overlay in the locked file, replacing any existing contents
+bool COverlay::Create (UINT uChunkSize_, uint64_t ullChunks_, uint64_t ullSize_)
+{
+    delete[] m_pbBitmap;
+    m_pbBitmap = nullptr;
+    m_ullUsed = 0;
+
+    m_sHeader = OVERLAY_HEADER();
+    memcpy(m_sHeader.szSignature, OVERLAY_SIGNATURE, sizeof(m_sHeader.szSignature));
+    m_sHeader.dwVersion = OVERLAY_VERSION;
+    m_sHeader.dwChunkSize = uChunkSize_;
+    m_sHeader.ullChunks = ullChunks_;
+    m_sHeader.ullSize = ullSize_;
+
+    if (!GetBaseDetails(&m_sHeader.ullBaseSize, &m_sHeader.llBaseTime))
+        return false;
+
+    // The bitmap is left for the writes to fill in, as a short file reads as clear
+    m_pbBitmap = new BYTE[GetBitmapSize()]();
+
+    // Keep the file open, so we don't lose the lock
+    if (m_hFile < 0 || !TruncateOverlay(m_hFile))
+        return false;
+
+    return WriteAt(m_hFile, 0, &m_sHeader, sizeof(m_sHeader));
+}
+
+// Discard all changes, starting afresh with the current base image
+bool COverlay::Reset ()
+{
+    return Create(m_sHeader.dwChunkSize, m_sHeader.ullChunks, m_sHeader.ullSize);
+}
+
+
+// Find the first changed chunk at or after the given chunk, or GetChunks() if there are none
+uint64_t COverlay::NextChunk (uint64_t ullChunk_) const
+{
+    while (ullChunk_ < m_sHeader.ullChunks)
+    {
+        // Skip whole bitmap bytes with no changes
+        if (!(ullChunk_ & 7) && !m_pbBitmap[ullChunk_ >> 3])
+            ullChunk_ += 8;
+        else if (HasChunk(ullChunk_))
+            return ullChunk_;
+        else
+            ullChunk_++;
+    }
+
+    return m_sHeader.ullChunks;
+}
+
+bool COverlay::Read (uint64_t ullChunk_, void* pv_)
+{
+    UINT uChunkSize = m_sHeader.dwChunkSize;
+    off_t lOffset = GetDataOffset() + static_cast<off_t>(ullChunk_) * uChunkSize;
+
+    return HasChunk(ullChunk_) && ReadAt(m_hFile, lOffset, pv_, uChunkSize) == static_cast<int>(uChunkSize);
+}
+
+bool COverlay::Write (uint64_t ullChunk_, UINT uChunks_, const void* pv_)
+{
+    UINT uChunkSize = m_sHeader.dwChunkSize;
+    off_t lOffset = GetDataOffset() + static_cast<off_t>(ullChunk_) * uChunkSize;
+
+    if (m_hFile < 0 || ullChunk_ + uChunks_ > m_sHeader.ullChunks)
+        return false;
+
+    // Write the data before marking it present
+    if (!WriteAt(m_hFile, lOffset, pv_, uChunks_ * uChunkSize))
+        return false;
+
+    bool fNew = false;
+    for (uint64_t u = ullChunk_ ; u < ullChunk_ + uChunks_ ; u++)
+    {
+        if (!HasChunk(u))
+        {
+            m_pbBitmap[u >> 3] |= (1 << (u & 7));
+            m_ullUsed++;
+            fNew = true;
+        }
+    }
+
+    // Update the bitmap bytes covering any newly present chunks
+    if (fNew)
+    {
+        size_t uFirst = static_cast<size_t>(ullChunk_ >> 3), uLast = static_cast<size_t>((ullChunk_ + uChunks_ - 1) >> 3);
+        return WriteAt(m_hFile, sizeof(m_sHeader) + uFirst, m_pbBitmap + uFirst, static_cast<UINT>(uLast - uFirst + 1));
+    }
+
+    return true;
+}
+
+bool COverlay::SetSize (uint64_t ullSize_)
+{
+    if (ullSize_ == m_sHeader.ullSize)
+        return true;
+
+    m_sHeader.ullSize = ullSize_;
+    return m_hFile >= 0 && WriteAt(m_hFile, 0, &m_sHeader, sizeof(m_sHeader));
+}
@@ -0,0 +1,88 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Overlay.h: Copy-on-write overlay files for disk images
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+const DWORD OVERLAY_VERSION = 1;
+const UINT OVERLAY_ALIGN = 4096;        // Alignment of the data area in the overlay file
+
+typedef struct
+{
+    char szSignature[8];    // "SIMCOVL\x1a"
+    DWORD dwVersion;        // OVERLAY_VERSION
+    DWORD dwChunkSize;      // Bytes in each chunk
+    uint64_t ullChunks;     // Chunks covered by the bitmap
+    uint64_t ullSize;       // Data size, which may differ from the base for rewritten images
+    uint64_t ullBaseSize;   // Base image size and modification time, to spot changes underneath us
+    int64_t llBaseTime;
+}
+OVERLAY_HEADER;
+
+
+class COverlay final
+{
+    public:
+        COverlay (const char* pcszPath_, const char* pcszBase_);
+        COverlay (const COverlay &) = delete;
+        void operator= (const COverlay &) = delete;
+        ~COverlay ();
+
+    public:
+        static bool IsEnabled ();
+        static COverlay* Open (const char* pcszBase_, UINT uChunkSize_, uint64_t ullChunks_, uint64_t ullSize_);
+
+    public:
+        const char* GetPath () const { return m_strPath.c_str(); }
+        UINT GetChunkSize () const { return m_sHeader.dwChunkSize; }
+        uint64_t GetChunks () const { return m_sHeader.ullChunks; }
+        uint64_t GetSize () const { return m_sHeader.ullSize; }
+        bool IsEmpty () const { return !m_ullUsed; }
+
+        bool HasChunk (uint64_t ullChunk_) const { return ullChunk_ < m_sHeader.ullChunks && (m_pbBitmap[ullChunk_ >> 3] & (1 << (ullChunk_ & 7))); }
+        uint64_t NextChunk (uint64_t ullChunk_) const;
+
+        bool Read (uint64_t ullChunk_, void* pv_);
+        bool Write (uint64_t ullChunk_, UINT uChunks_, const void* pv_);
+        bool SetSize (uint64_t ullSize_);
+        bool Reset ();
+
+    protected:
+        enum { overlayEmpty, overlayStale, overlayValid };
+
+        bool Lock ();
+        int Load (UINT uChunkSize_, uint64_t ullChunks_);
+        bool MoveAside ();
+        bool Create (UINT uChunkSize_, uint64_t ullChunks_, uint64_t ullSize_);
+        bool GetBaseDetails (uint64_t* pullSize_, int64_t* pllTime_) const;
+        off_t GetDataOffset () const;
+        size_t GetBitmapSize () const { return static_cast<size_t>((m_sHeader.ullChunks + 7) / 8); }
+
+    protected:
+        std::string m_strPath;
+        std::string m_strBase;
+        int m_hFile = -1;
+
+        OVERLAY_HEADER m_sHeader {};
+        BYTE *m_pbBitmap = nullptr;     // One bit per chunk, set if the chunk data is in the overlay
+        uint64_t m_ullUsed = 0;         // Chunks held in the overlay
+};
+
+#endif // OVERLAY_H
@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // - removed export wrapper to expose implementation class
 // - removed parameter config, leaving 16-bit stereo samples only
 // - caller-supplied output frequency, rather than fixed 44.1KHz
+// - runs of unchanged output samples are generated in bulk
 
 #include "SimCoupe.h"
 
@@ -179,6 +180,12 @@ void CSAAAmp::Mute(bool bMute)
 	m_bMute = bMute;
 }
 
+bool CSAAAmp::UsesNoise() const
+{
+	// noise level only affects the output if it's mixed in and we're not muted
+	return !m_bMute && (m_nMixMode & 0x02);
+}
+
 
 void CSAAAmp::Tick()
 {
@@ -672,7 +679,7 @@ void CSAAFreq::UpdateOctaveOffsetData()
 void CSAAFreq::SetSampleRate(int nSampleRate)
 {
 	m_nCounter = 0;	// don't bother adjusting existing value
-	m_nSampleRateTimes4K = nSampleRate << 12;
+	m_nSampleRateTimes4K = static_cast<unsigned long>(nSampleRate) << 12;
 }
 
 unsigned short CSAAFreq::Level() const
@@ -728,6 +735,23 @@ unsigned short CSAAFreq::Tick()
 }
 
 
+unsigned long CSAAFreq::TicksToChange() const
+{
+	// number of ticks before the next half-cycle completes, which never happens if synced
+	if (m_bSync || !m_nAdd)
+		return ~0UL;
+
+	return (m_nSampleRateTimes4K - 1 - m_nCounter) / m_nAdd;
+}
+
+void CSAAFreq::Advance(unsigned long nTicks)
+{
+	// bulk equivalent of Tick(), for a run no longer than TicksToChange()
+	if (!m_bSync)
+		m_nCounter += m_nAdd * nTicks;
+}
+
+
 void CSAAFreq::SetAdd()
 {
 	// nOctave between 0 and 7; nOffset between 0 and 255
@@ -845,6 +869,30 @@ unsigned short CSAANoise::Tick()
 	return (unsigned short)(m_nRand & 0x00000001);
 }
 
+unsigned long CSAANoise::TicksToChange() const
+{
+	// number of ticks before the level next changes, which never happens from Tick()
+	// if synced or clocked by the frequency generator
+	if (m_bSync || m_nSourceMode == 3)
+		return ~0UL;
+
+	return (m_nSampleRateTimes4K - 1 - m_nCounter) / m_nAdd;
+}
+
+void CSAANoise::Advance(unsigned long nTicks)
+{
+	// bulk equivalent of Tick(), which may cross any number of level changes
+	if ( (!m_bSync) && (m_nSourceMode!=3) )
+	{
+		unsigned long long nTotal = m_nCounter + static_cast<unsigned long long>(m_nAdd) * nTicks;
+		unsigned long long nChanges = nTotal / m_nSampleRateTimes4K;
+		m_nCounter = static_cast<unsigned long>(nTotal % m_nSampleRateTimes4K);
+
+		while (nChanges--)
+			ChangeLevel();
+	}
+}
+
 void CSAANoise::Sync(bool bSync)
 {
 	if (bSync)
@@ -856,7 +904,7 @@ void CSAANoise::Sync(bool bSync)
 void CSAANoise::SetSampleRate(int nSampleRate)
 {
 	m_nCounter = 0;	// don't bother adjusting existing value
-	m_nSampleRateTimes4K = nSampleRate << 12;
+	m_nSampleRateTimes4K = static_cast<unsigned long>(nSampleRate) << 12;
 }
 
 inline void CSAANoise::ChangeLevel()
@@ -905,14 +953,7 @@ m_bSync(false)
 	Amp[5] = new CSAAAmp(Osc[5], Noise[1], Env[1]);
 
 	// Set the output frequency
-	Osc[0]->SetSampleRate(nSampleRate);
-	Osc[1]->SetSampleRate(nSampleRate);
-	Osc[2]->SetSampleRate(nSampleRate);
-	Osc[3]->SetSampleRate(nSampleRate);
-	Osc[4]->SetSampleRate(nSampleRate);
-	Osc[5]->SetSampleRate(nSampleRate);
-	Noise[0]->SetSampleRate(nSampleRate);
-	Noise[1]->SetSampleRate(nSampleRate);
+	SetSampleRate(nSampleRate);
 
 	// reset the virtual SAA
 	Clear();
@@ -1138,29 +1179,77 @@ BYTE CSAASound::ReadAddress()
 	return m_nCurrentSaaReg;
 }
 
+void CSAASound::SetSampleRate(int nSampleRate)
+{
+	// restarts any part-complete generator cycles
+	for (int i = 0; i < 6; i++)
+		Osc[i]->SetSampleRate(nSampleRate);
+
+	Noise[0]->SetSampleRate(nSampleRate);
+	Noise[1]->SetSampleRate(nSampleRate);
+}
+
+int CSAASound::Step(int nMaxTicks, CSAAAmp::stereolevel &rLevel)
+{
+	// Tick once, then advance over any following ticks that can't change the output,
+	// up to nMaxTicks in total. Returns the number of ticks the level applies to.
+	Noise[0]->Tick();
+	Noise[1]->Tick();
+
+	rLevel.dword=(Amp[0]->TickAndOutputStereo()).dword;
+	rLevel.dword+=(Amp[1]->TickAndOutputStereo()).dword;
+	rLevel.dword+=(Amp[2]->TickAndOutputStereo()).dword;
+	rLevel.dword+=(Amp[3]->TickAndOutputStereo()).dword;
+	rLevel.dword+=(Amp[4]->TickAndOutputStereo()).dword;
+	rLevel.dword+=(Amp[5]->TickAndOutputStereo()).dword;
+
+	// The output can't change until a frequency generator completes a half-cycle
+	// (which also clocks any envelopes), or a noise generator in use changes level
+	unsigned long nRun = static_cast<unsigned long>(nMaxTicks - 1);
+	for (int i = 0; i < 6; i++)
+		nRun = std::min(nRun, Osc[i]->TicksToChange());
+
+	if (Amp[0]->UsesNoise() || Amp[1]->UsesNoise() || Amp[2]->UsesNoise())
+		nRun = std::min(nRun, Noise[0]->TicksToChange());
+	if (Amp[3]->UsesNoise() || Amp[4]->UsesNoise() || Amp[5]->UsesNoise())
+		nRun = std::min(nRun, Noise[1]->TicksToChange());
+
+	if (nRun)
+	{
+		// advance all generators over the run
+		for (int i = 0; i < 6; i++)
+			Osc[i]->Advance(nRun);
+
+		Noise[0]->Advance(nRun);
+		Noise[1]->Advance(nRun);
+	}
+
+	return 1 + static_cast<int>(nRun);
+}
+
 void CSAASound::GenerateMany(BYTE * pBuffer, int nSamples)
 {
 	CSAAAmp::stereolevel stereoval;
 
-	while (nSamples-- > 0)
+	while (nSamples > 0)
 	{
-		Noise[0]->Tick();
-		Noise[1]->Tick();
-
-		stereoval.dword=(Amp[0]->TickAndOutputStereo()).dword;
-		stereoval.dword+=(Amp[1]->TickAndOutputStereo()).dword;
-		stereoval.dword+=(Amp[2]->TickAndOutputStereo()).dword;
-		stereoval.dword+=(Amp[3]->TickAndOutputStereo()).dword;
-		stereoval.dword+=(Amp[4]->TickAndOutputStereo()).dword;
-		stereoval.dword+=(Amp[5]->TickAndOutputStereo()).dword;
+		int nRun = Step(nSamples, stereoval);
 
 		// force output into the range 0<=x<=65535
 		// (strictly, the following gives us 0<=x<=63360)
 		stereoval.sep.Left *= 10;
 		stereoval.sep.Right *= 10;
-		*pBuffer++ = stereoval.sep.Left & 0x00ff;
-		*pBuffer++ = stereoval.sep.Left >> 8;
-		*pBuffer++ = stereoval.sep.Right & 0x00ff;
-		*pBuffer++ = stereoval.sep.Right >> 8;
+
+		BYTE abSample[4];
+		abSample[0] = stereoval.sep.Left & 0x00ff;
+		abSample[1] = stereoval.sep.Left >> 8;
+		abSample[2] = stereoval.sep.Right & 0x00ff;
+		abSample[3] = stereoval.sep.Right >> 8;
+
+		// repeat the current output for the run
+		for (int n = 0; n < nRun; n++, pBuffer += 4)
+			memcpy(pBuffer, abSample, sizeof(abSample));
+
+		nSamples -= nRun;
 	}
 }
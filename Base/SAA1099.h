@@ -84,6 +84,9 @@ public:
 	unsigned short LevelTimesTwo() const;
 	void Sync(bool bSync);
 
+	unsigned long TicksToChange() const;
+	void Advance(unsigned long nTicks);
+
 };
 
 
@@ -122,6 +125,9 @@ public:
 	unsigned short Tick();
 	unsigned short Level() const;
 
+	unsigned long TicksToChange() const;
+	void Advance(unsigned long nTicks);
+
 };
 
 
@@ -163,6 +169,7 @@ public:
 	unsigned short RightOutput() const;
 	unsigned short MonoOutput() const;
 	void Mute(bool bMute);
+	bool UsesNoise() const;
 	void Tick();
 	unsigned short TickAndOutputMono();
 	stereolevel TickAndOutputStereo();
@@ -194,6 +201,8 @@ public:
 	void Clear();
 	BYTE ReadAddress();
 
+	void SetSampleRate(int nSampleRate);
+	int Step(int nMaxTicks, CSAAAmp::stereolevel &rLevel);
 	void GenerateMany(BYTE * pBuffer, int nSamples);
 };
 
@@ -43,29 +43,41 @@ CSID::~CSID ()
 void CSID::Reset ()
 {
 #ifdef USE_RESID
+    // Complete any output using the old chip state
+    if (m_nWrites)
+        Replay(pDAC->GetSamplesSoFar(), g_dwCycleCounter);
+
     if (m_pSID)
     {
         m_nChipType = GetOption(sid);
         m_pSID->set_chip_model((m_nChipType == 2) ? RESID_NAMESPACE::MOS8580 : RESID_NAMESPACE::MOS6581);
 
         m_pSID->reset();
-        m_pSID->adjust_sampling_frequency(SAMPLE_FREQ);
+        m_pSID->adjust_sampling_frequency(Sound::GetSampleFreq());
     }
 #endif
 }
 
-void CSID::Update (bool fFrameEnd_=false)
+void CSID::SetSampleFreq (int nFreq_)
 {
 #ifdef USE_RESID
-    int nSamplesSoFar = fFrameEnd_ ? pDAC->GetSampleCount() : pDAC->GetSamplesSoFar();
+    if (m_pSID)
+        m_pSID->adjust_sampling_frequency(nFreq_);
+#else
+    (void)nFreq_;
+#endif
+}
 
-    int nNeeded = nSamplesSoFar - m_nSamplesThisFrame;
+void CSID::Generate (int nSamples_, DWORD /*dwTime_*/)
+{
+#ifdef USE_RESID
+    int nNeeded = nSamples_ - m_nSamplesThisFrame;
     if (!m_pSID || nNeeded <= 0)
         return;
 
     short *ps = reinterpret_cast<short*>(m_pbFrameSample + m_nSamplesThisFrame*SAMPLE_BLOCK);
 
-    if (g_fReset)
+    if (m_fReset)
         memset(ps, 0x00, nNeeded*SAMPLE_BLOCK); // no clock means no output
     else
     {
@@ -79,27 +91,30 @@ void CSID::Update (bool fFrameEnd_=false)
             ps[1] = ps[0];
     }
 
-    m_nSamplesThisFrame = nSamplesSoFar;
+    m_nSamplesThisFrame = nSamples_;
 #else
-	(void)fFrameEnd_;
+    (void)nSamples_;
 #endif
 }
 
 void CSID::FrameEnd ()
 {
-    // Check for change of chip type
+    Replay(pDAC->GetSampleCount(), TSTATES_PER_FRAME);
+    m_nSamplesThisFrame = 0;
+
+    // Check for change of chip type, which takes effect from the next frame
     if (GetOption(sid) != m_nChipType)
         Reset();
-
-    Update(true);
-    m_nSamplesThisFrame = 0;
 }
 
 void CSID::Out (WORD wPort_, BYTE bVal_)
 {
-#ifdef USE_RESID
-    Update();
+    LogWrite(wPort_, bVal_);
+}
 
+void CSID::Write (WORD wPort_, BYTE bVal_)
+{
+#ifdef USE_RESID
     BYTE bReg = wPort_ >> 8;
 
     if (m_pSID)
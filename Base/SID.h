@@ -44,11 +44,15 @@ class CSID final : public CSoundDevice
 
     public:
         void Reset () override;
-        void Update (bool fFrameEnd_);
         void FrameEnd () override;
+        void SetSampleFreq (int nFreq_) override;
 
         void Out (WORD wPort_, BYTE bVal_) override;
 
+    protected:
+        void Generate (int nSamples_, DWORD dwTime_) override;
+        void Write (WORD wPort_, BYTE bVal_) override;
+
     protected:
 #ifdef USE_RESID
         RESID_NAMESPACE::SID *m_pSID = nullptr;
@@ -36,6 +36,21 @@ static int nClipX, nClipY, nClipWidth, nClipHeight;    // Clip box for any scree
 
 static const GUIFONT* pFont = &sGUIFont;
 
+static uint64_t aullRowMasks[256];  // Byte masks for each 8-pixel font row pattern
+
+
+// Expand each possible font row bit pattern to a mask with 0xff for each set pixel
+static void InitRowMasks ()
+{
+    for (int i = 0 ; i < 256 ; i++)
+    {
+        BYTE ab[8];
+        for (int j = 0 ; j < 8 ; j++)
+            ab[j] = (i & (0x80 >> j)) ? 0xff : 0x00;
+
+        memcpy(&aullRowMasks[i], ab, sizeof(ab));
+    }
+}
 
 CScreen::CScreen (int nWidth_, int nHeight_)
 {
@@ -49,9 +64,14 @@ CScreen::CScreen (int nWidth_, int nHeight_)
     for (int i = 0 ; i < m_nHeight ; i++)
         m_ppbLines[i] = m_pbFrame + (m_nPitch * i);
 
+    // Prepare the font row masks on first use
+    if (!aullRowMasks[1])
+        InitRowMasks();
+
     // Set default clipping (full screen) and clear the screen
     SetClip();
     Clear();
+    ResetDrawnLines();
 }
 
 CScreen::~CScreen ()
@@ -92,7 +112,26 @@ bool CScreen::Clip (int& rnX_, int& rnY_, int& rnWidth_, int& rnHeight_)
     if (rnY_+rnHeight_ > b) rnHeight_ = b - rnY_;
 
     // Return if there's anything left to draw
-    return rnWidth_ > 0 && rnHeight_ > 0;
+    if (rnWidth_ <= 0 || rnHeight_ <= 0)
+        return false;
+
+    MarkDrawnLines(rnY_, rnHeight_);
+    return true;
+}
+
+// Extend the range of lines known to have been drawn on
+void CScreen::MarkDrawnLines (int nY_, int nHeight_)
+{
+    m_nDrawnTop = std::min(m_nDrawnTop, nY_);
+    m_nDrawnBottom = std::max(m_nDrawnBottom, nY_+nHeight_-1);
+}
+
+// Fetch the range of lines drawn on since the last reset, if any
+bool CScreen::GetDrawnLines (int& rnTop_, int& rnBottom_) const
+{
+    rnTop_ = std::max(m_nDrawnTop, 0);
+    rnBottom_ = std::min(m_nDrawnBottom, m_nHeight-1);
+    return rnTop_ <= rnBottom_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -283,8 +322,27 @@ int CScreen::DrawString (int nX_, int nY_, const char* pcsz_, BYTE bInk_/*=WHITE
         {
             BYTE* pLine = GetLine(nFrom) + nX_;
             pbData += (nFrom - nY_);
+            if (nFrom < nTo)
+                MarkDrawnLines(nFrom, nTo-nFrom);
 
-            for (int i = nFrom ; i < nTo ; pLine += m_nPitch, i += 1)
+            // Blend complete rows using the expanded masks, if there's room on the line
+            if (nX_+8 <= m_nPitch)
+            {
+                uint64_t ullInk = bInk_ * 0x0101010101010101ULL;
+
+                for (int i = nFrom ; i < nTo ; pLine += m_nPitch, i += 1)
+                {
+                    uint64_t ullMask = aullRowMasks[*pbData++], ull;
+
+                    if (ullMask)
+                    {
+                        memcpy(&ull, pLine, sizeof(ull));
+                        ull = (ull & ~ullMask) | (ullInk & ullMask);
+                        memcpy(pLine, &ull, sizeof(ull));
+                    }
+                }
+            }
+            else for (int i = nFrom ; i < nTo ; pLine += m_nPitch, i += 1)
             {
                 BYTE bData = *pbData++;
 
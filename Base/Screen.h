@@ -64,6 +64,10 @@ class CScreen final
         void SetClip (int nX_=0, int nY_=0, int nWidth_=0, int nHeight_=0);
         bool Clip (int& rnX_, int& rnY_, int& rnWidth_, int& rnHeight_);
 
+        void ResetDrawnLines () { m_nDrawnTop = m_nHeight; m_nDrawnBottom = -1; }
+        void MarkDrawnLines (int nY_, int nHeight_);
+        bool GetDrawnLines (int& rnTop_, int& rnBottom_) const;
+
         void Plot (int nX_, int nY_, BYTE bColour_);
         void DrawLine (int nX_, int nY_, int nWidth_, int nHeight_, BYTE bColour_);
         void FillRect (int nX_, int nY_, int nWidth_, int nHeight_, BYTE bColour_);
@@ -81,6 +85,8 @@ class CScreen final
 
         BYTE *m_pbFrame = nullptr;          // Screen data block
         BYTE **m_ppbLines = nullptr;        // Look-up table from line number to pointer to start of the line
+
+        int m_nDrawnTop = 0, m_nDrawnBottom = -1;   // Range of lines touched by drawing functions
 };
 
 #endif  // SCREEN_H
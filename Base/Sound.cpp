@@ -27,12 +27,26 @@
 #include "Frame.h"
 #include "Options.h"
 #include "SID.h"
+#include "ThreadPool.h"
+#include "TimeStretch.h"
 #include "WAV.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 static BYTE *pbSampleBuffer;
+static int nSampleBufferSize;
+static CTimeStretch *pTimeStretch;  // Fits the audio to non-100% running speeds
+static int nSampleFreq = SAMPLE_FREQ_DEFAULT;
+static CThreadPool *pThreadPool;    // Synthesises sound chips in parallel at frame end
 
-static void MixAudio (BYTE *pDst_, const BYTE *pSrc_, int nLen_);
-static int AdjustSpeed (BYTE *pb_, int nSize_, int nSpeed_);
+static void MixAudio (BYTE *pDst_, const BYTE *pSrc_, int nLen_, int nGain_=GAIN_UNITY);
+static void FrameEndBand (void *pvParam_, int nFrom_, int nTo_);
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -40,9 +54,23 @@ bool Sound::Init (bool fFirstInit_/*=false*/)
 {
     Exit();
 
+    // Apply any change of output rate to the sound chips
+    int nFreq = std::min(std::max(GetOption(samplerate), SAMPLE_FREQ_MIN), SAMPLE_FREQ_MAX);
+    if (nFreq != nSampleFreq)
+    {
+        nSampleFreq = nFreq;
+
+        if (pDAC) pDAC->SetSampleFreq(nSampleFreq);
+        if (pSAA) pSAA->SetSampleFreq(nSampleFreq);
+        if (pSID) pSID->SetSampleFreq(nSampleFreq);
+    }
+
     int nMaxFrameSamples = 2; // Needed for 50% running speed
-    int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND)+1;
-    pbSampleBuffer = new BYTE[nSamplesPerFrame*SAMPLE_BLOCK*nMaxFrameSamples];
+    int nSamplesPerFrame = (nSampleFreq / EMULATED_FRAMES_PER_SECOND)+1;
+    nSampleBufferSize = nSamplesPerFrame*SAMPLE_BLOCK*nMaxFrameSamples;
+    pbSampleBuffer = new BYTE[nSampleBufferSize];
+    pTimeStretch = new CTimeStretch(nSampleFreq);
+    pThreadPool = new CThreadPool(2);
 
     bool fRet = Audio::Init(fFirstInit_);
     Audio::Silence();
@@ -56,6 +84,8 @@ void Sound::Exit (bool fReInit_/*=false*/)
     AVI::Stop();
 
     delete[] pbSampleBuffer, pbSampleBuffer = nullptr;
+    delete pTimeStretch, pTimeStretch = nullptr;
+    delete pThreadPool, pThreadPool = nullptr;
     Audio::Exit(fReInit_);
 }
 
@@ -64,73 +94,218 @@ void Sound::Silence ()
     Audio::Silence();
 }
 
+int Sound::GetSampleFreq ()
+{
+    return nSampleFreq;
+}
+
+// Log a change of reset state with the chips, which have no clock while reset is held
+void Sound::SetReset (bool fReset_)
+{
+    if (pSAA) pSAA->LogReset(fReset_);
+    if (pSID) pSID->LogReset(fReset_);
+}
+
 void Sound::FrameUpdate ()
 {
     static bool fSidUsed = false;
 
     // Track whether SID has been used, to avoid unnecessary sample generation+mixing
-    fSidUsed |= pSID->GetSampleCount() != 0;
+    fSidUsed |= pSID->GetWriteCount() != 0 || pSID->GetSampleCount() != 0;
+
+    // Nothing is heard in turbo mode, or when muted and not recording, so skip generating and mixing
+    if (g_nTurbo || (!GetOption(sound) && !WAV::IsRecording() && !AVI::IsRecording()))
+    {
+        pDAC->FrameSkip();
+        pSAA->FrameSkip();
+        pSID->FrameSkip();
+
+        // Turbo mode runs flat out, otherwise we still need the frame pacing from the audio code
+        if (!g_nTurbo)
+        {
+            int nSamples = pDAC->GetSampleCount() * 100 / std::max(GetOption(speed), 50);
+            int nSize = std::min(nSamples*SAMPLE_BLOCK, nSampleBufferSize);
+
+            memset(pbSampleBuffer, 0x00, nSize);
+            Audio::AddData(pbSampleBuffer, nSize);
+        }
+
+        return;
+    }
 
     pDAC->FrameEnd();   // set the actual sample count
-    pSAA->FrameEnd();   // catch-up to the DAC position
-    if (fSidUsed) pSID->FrameEnd();
+
+    // Apply the volume levels for each source
+    pDAC->SetGain(GetOption(dacvolume) * GAIN_UNITY / 100);
+    pSAA->SetGain(GetOption(saavolume) * GAIN_UNITY / 100);
+    pSID->SetGain(GetOption(sidvolume) * GAIN_UNITY / 100);
+
+    // Synthesise the SAA and SID output up to the DAC position from their logged writes, in parallel
+    CSoundDevice *apDevices[] = { pSAA, pSID };
+    pThreadPool->Run(FrameEndBand, apDevices, fSidUsed ? 2 : 1);
 
     // Use the DAC as the master clock for sample count
     int nSamples = pDAC->GetSampleCount();
     int nSize = nSamples*SAMPLE_BLOCK;
 
-    // Copy in the DAC samples, then mix SAA and possibly SID too
-    memcpy(pbSampleBuffer, pDAC->GetSampleBuffer(), nSize);
-    MixAudio(pbSampleBuffer, pSAA->GetSampleBuffer(), nSize);
-    if (fSidUsed && GetOption(sid)) MixAudio(pbSampleBuffer, pSID->GetSampleBuffer(), nSize);
+    // Copy in the DAC samples (mixing into silence if they need scaling), then mix SAA and possibly SID too
+    if (pDAC->GetGain() == GAIN_UNITY)
+        memcpy(pbSampleBuffer, pDAC->GetSampleBuffer(), nSize);
+    else
+    {
+        memset(pbSampleBuffer, 0x00, nSize);
+        MixAudio(pbSampleBuffer, pDAC->GetSampleBuffer(), nSize, pDAC->GetGain());
+    }
+
+    MixAudio(pbSampleBuffer, pSAA->GetSampleBuffer(), nSize, pSAA->GetGain());
+    if (fSidUsed && GetOption(sid)) MixAudio(pbSampleBuffer, pSID->GetSampleBuffer(), nSize, pSID->GetGain());
 
     // Add the frame to any recordings
     WAV::AddFrame(pbSampleBuffer, nSize);
     AVI::AddFrame(pbSampleBuffer, nSize);
 
-#if SAMPLE_FREQ == 44100 && SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
-    // Scale the audio to fit the require running speed
-    nSize = AdjustSpeed(pbSampleBuffer, nSize, GetOption(speed));
+#if SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
+    // Time-stretch the audio to fit the required running speed, keeping the pitch
+    nSize = pTimeStretch->Process(pbSampleBuffer, nSize, nSampleBufferSize, GetOption(speed));
 #endif
 
     // Queue the data for playback
     Audio::AddData(pbSampleBuffer, nSize);
 }
 
+// Thread pool band, completing the frame for a range of sound devices
+static void FrameEndBand (void *pvParam_, int nFrom_, int nTo_)
+{
+    CSoundDevice **ppDevices = reinterpret_cast<CSoundDevice**>(pvParam_);
+
+    for (int i = nFrom_ ; i < nTo_ ; i++)
+        ppDevices[i]->FrameEnd();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-void CSAA::Update (bool fFrameEnd_=false)
+CSAA::CSAA ()
 {
-    int nSamplesSoFar = fFrameEnd_ ? pDAC->GetSampleCount() : pDAC->GetSamplesSoFar();
+    m_pSAASound = new CSAASound(Sound::GetSampleFreq());
+    m_pSAABlip = new CSAASound(SAA_TICK_RATE);
 
-    int nNeeded = nSamplesSoFar - m_nSamplesThisFrame;
+    buf_left.clock_rate(REAL_TSTATES_PER_SECOND);
+    buf_right.clock_rate(REAL_TSTATES_PER_SECOND);
+    buf_left.set_sample_rate(Sound::GetSampleFreq());
+    buf_right.set_sample_rate(Sound::GetSampleFreq());
+
+    synth_left.output(&buf_left);
+    synth_right.output(&buf_right);
+
+    // Match the 10x scaling applied to the point-sampled output
+    synth_left.volume(10.0 * SAA_BLIP_RANGE / 65536);
+    synth_right.volume(10.0 * SAA_BLIP_RANGE / 65536);
+
+    m_fBlip = GetOption(saablip);
+}
+
+void CSAA::Generate (int nSamples_, DWORD dwTime_)
+{
+    if (m_fBlip)
+    {
+        GenerateBlip(dwTime_);
+        return;
+    }
+
+    int nNeeded = nSamples_ - m_nSamplesThisFrame;
     if (nNeeded <= 0)
         return;
 
     BYTE *pb = m_pbFrameSample + m_nSamplesThisFrame*SAMPLE_BLOCK;
 
-    if (g_fReset)
+    if (m_fReset)
         memset(pb, 0x00, nNeeded*SAMPLE_BLOCK); // no clock means no SAA output
     else
         m_pSAASound->GenerateMany(pb, nNeeded);
 
-    m_nSamplesThisFrame = nSamplesSoFar;
+    m_nSamplesThisFrame = nSamples_;
+}
+
+void CSAA::GenerateBlip (DWORD dwTime_)
+{
+    UINT uCycles = std::min(dwTime_, static_cast<DWORD>(TSTATES_PER_FRAME));
+    int nTicksSoFar = static_cast<int>(uCycles / TSTATES_PER_SAA_TICK);
+
+    // Feed each output level change to the synths, timestamped at the chip tick it happened
+    while (m_nTicksThisFrame < nTicksSoFar)
+    {
+        CSAAAmp::stereolevel level;
+        blip_time_t tTime = m_nTicksThisFrame * TSTATES_PER_SAA_TICK;
+        m_nTicksThisFrame += m_pSAABlip->Step(nTicksSoFar - m_nTicksThisFrame, level);
+
+        if (m_fReset)
+            level.dword = 0;    // no clock means no SAA output
+
+        synth_left.update(tTime, level.sep.Left);
+        synth_right.update(tTime, level.sep.Right);
+    }
 }
 
 void CSAA::FrameEnd ()
 {
-    Update(true);
+    Replay(pDAC->GetSampleCount(), TSTATES_PER_FRAME);
+
+    if (m_fBlip)
+    {
+        buf_left.end_frame(TSTATES_PER_FRAME);
+        buf_right.end_frame(TSTATES_PER_FRAME);
+
+        blip_sample_t *ps = reinterpret_cast<blip_sample_t*>(m_pbFrameSample);
+        int nSamples = static_cast<int>(buf_left.samples_avail());
+
+        buf_left.read_samples(ps, nSamples, 1);
+        buf_right.read_samples(ps+1, nSamples, 1);
+    }
+
     m_nSamplesThisFrame = 0;
+    m_nTicksThisFrame = 0;
+
+    // Switch output method only at a frame boundary, discarding anything left in the synth buffers
+    if (m_fBlip != GetOption(saablip))
+    {
+        m_fBlip = GetOption(saablip);
+        buf_left.clear();
+        buf_right.clear();
+    }
+}
+
+void CSAA::FrameSkip ()
+{
+    CSoundDevice::FrameSkip();
+    m_nTicksThisFrame = 0;
+}
+
+void CSAA::SetSampleFreq (int nFreq_)
+{
+    m_pSAASound->SetSampleRate(nFreq_);
+
+    buf_left.set_sample_rate(nFreq_);
+    buf_right.set_sample_rate(nFreq_);
 }
 
 void CSAA::Out (WORD wPort_, BYTE bVal_)
 {
-    Update();
+    LogWrite(wPort_, bVal_);
+}
 
+void CSAA::Write (WORD wPort_, BYTE bVal_)
+{
+    // Both chip instances see every write, so either can take over at the next frame
     if ((wPort_ & SOUND_MASK) == SOUND_ADDR)
+    {
         m_pSAASound->WriteAddress(bVal_);
+        m_pSAABlip->WriteAddress(bVal_);
+    }
     else
+    {
         m_pSAASound->WriteData(bVal_);
+        m_pSAABlip->WriteData(bVal_);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -139,8 +314,8 @@ CDAC::CDAC ()
 {
     buf_left.clock_rate(REAL_TSTATES_PER_SECOND);
     buf_right.clock_rate(REAL_TSTATES_PER_SECOND);
-    buf_left.set_sample_rate(SAMPLE_FREQ);
-    buf_right.set_sample_rate(SAMPLE_FREQ);
+    buf_left.set_sample_rate(Sound::GetSampleFreq());
+    buf_right.set_sample_rate(Sound::GetSampleFreq());
 
     synth_left.output(&buf_left);
     synth_left2.output(&buf_left);
@@ -173,6 +348,12 @@ void CDAC::FrameEnd ()
     buf_right.read_samples(ps+1, m_nSamplesThisFrame, 1);
 }
 
+void CDAC::SetSampleFreq (int nFreq_)
+{
+    buf_left.set_sample_rate(nFreq_);
+    buf_right.set_sample_rate(nFreq_);
+}
+
 void CDAC::OutputLeft (BYTE bVal_)
 {
     synth_left.update(g_dwCycleCounter, bVal_);
@@ -223,72 +404,165 @@ void CBeeperDevice::Out(WORD /*wPort_*/, BYTE bVal_)
 
 CSoundDevice::CSoundDevice ()
 {
-    int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND)+1;
+    int nSamplesPerFrame = (SAMPLE_FREQ_MAX / EMULATED_FRAMES_PER_SECOND)+1;
     int nSize = nSamplesPerFrame*SAMPLE_BLOCK;
 
     m_pbFrameSample = new BYTE[nSize];
     memset(m_pbFrameSample, 0x00, nSize);
+
+    m_pWrites = new SOUNDWRITE[MAX_SOUND_WRITES];
+    m_fReset = g_fReset;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+// Allocate the next log entry, stamped with the current time and reset state
+SOUNDWRITE *CSoundDevice::NewWrite ()
+{
+    // If the log is full, synthesise what we have so far to make space (or just apply it in turbo mode)
+    if (m_nWrites == MAX_SOUND_WRITES)
+    {
+        if (g_nTurbo)
+            ApplyWrites();
+        else
+            Replay(pDAC->GetSamplesSoFar(), g_dwCycleCounter);
+    }
+
+    SOUNDWRITE *pWrite = &m_pWrites[m_nWrites++];
+    pWrite->dwTime = g_dwCycleCounter;
+    pWrite->nSample = pDAC->GetSamplesSoFar();
+    pWrite->fReset = g_fReset;
+    return pWrite;
+}
 
-// Basic audio mixing
-static void MixAudio (BYTE *pDst_, const BYTE *pSrc_, int nLen_)
+void CSoundDevice::LogWrite (WORD wPort_, BYTE bVal_)
 {
-    for (nLen_ /= 2 ; nLen_-- > 0 ; pSrc_ += 2, pDst_ += 2)
+    SOUNDWRITE *pWrite = NewWrite();
+    pWrite->fWrite = true;
+    pWrite->wPort = wPort_;
+    pWrite->bVal = bVal_;
+}
+
+// Log a change of reset state, so output is muted from the point the chip clock stopped
+void CSoundDevice::LogReset (bool fReset_)
+{
+    SOUNDWRITE *pWrite = NewWrite();
+    pWrite->fWrite = false;
+    pWrite->fReset = fReset_;
+}
+
+// Synthesise output up to each logged write before applying it, then up to the given position
+void CSoundDevice::Replay (int nSamples_, DWORD dwTime_)
+{
+    for (int i = 0 ; i < m_nWrites ; i++)
+    {
+        Generate(m_pWrites[i].nSample, m_pWrites[i].dwTime);
+
+        m_fReset = m_pWrites[i].fReset;
+        if (m_pWrites[i].fWrite)
+            Write(m_pWrites[i].wPort, m_pWrites[i].bVal);
+    }
+
+    m_nWrites = 0;
+    Generate(nSamples_, dwTime_);
+}
+
+// Apply logged writes to the chip without generating any output
+void CSoundDevice::ApplyWrites ()
+{
+    for (int i = 0 ; i < m_nWrites ; i++)
     {
-        // Add two 16-bit samples
-        short s1 = (pSrc_[1] << 8) | pSrc_[0];
-        short s2 = (pDst_[1] << 8) | pDst_[0];
-        int samp = s1 + s2;
-
-        // Clip to signed range
-        samp = std::min(samp, 32767);
-        samp = std::max(-32768, samp);
-
-        // Write new sample
-        pDst_[0] = samp & 0xff;
-        pDst_[1] = samp >> 8;
+        m_fReset = m_pWrites[i].fReset;
+        if (m_pWrites[i].fWrite)
+            Write(m_pWrites[i].wPort, m_pWrites[i].bVal);
     }
+
+    m_nWrites = 0;
+}
+
+// Complete a frame that won't be heard, keeping the chip state current for when output resumes
+void CSoundDevice::FrameSkip ()
+{
+    ApplyWrites();
+    m_nSamplesThisFrame = 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
 
-// Scale audio data to fit the current emulator speed setting
-static int AdjustSpeed (BYTE *pb_, int nSize_, int nSpeed_)
+// Mix 16-bit source samples into the destination with saturation, scaling the source by a gain.
+// At unity gain the result is identical to a clipped add of the two samples.
+static void MixAudio (BYTE *pDst_, const BYTE *pSrc_, int nLen_, int nGain_/*=GAIN_UNITY*/)
 {
-    // Limit speed range
-    nSpeed_ = std::max(nSpeed_,50);
-    nSpeed_ = std::min(nSpeed_,1000);
+    int16_t *psDst = reinterpret_cast<int16_t*>(pDst_);
+    const int16_t *psSrc = reinterpret_cast<const int16_t*>(pSrc_);
+    int nSamples = nLen_ / 2, i = 0;
 
-    // Slow?
-    if (nSpeed_ < 100)
+#if defined(SIMD_SSE2)
+    if (nGain_ == GAIN_UNITY)
+    {
+        for ( ; i+8 <= nSamples ; i += 8)
+        {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(psDst+i));
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(psSrc+i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(psDst+i), _mm_adds_epi16(d, s));
+        }
+    }
+    else
     {
-        DWORD *pdwS = reinterpret_cast<DWORD*>(pb_ + nSize_) - 1;
-        DWORD *pdwD = reinterpret_cast<DWORD*>(pb_ + nSize_*2) - 1;
+        __m128i g = _mm_set1_epi16(static_cast<short>(nGain_));
 
-        // Double samples in reverse order
-        for (int i = 0 ; i < nSize_ ; i += SAMPLE_BLOCK, pdwS--)
-            *pdwD-- = *pdwS, *pdwD-- = *pdwS;
+        for ( ; i+8 <= nSamples ; i += 8)
+        {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(psDst+i));
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(psSrc+i));
 
-        nSize_ *= 2;
+            // Form the 32-bit products, scale back down, and pack with saturation
+            __m128i lo = _mm_mullo_epi16(s, g), hi = _mm_mulhi_epi16(s, g);
+            __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), GAIN_SHIFT);
+            __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), GAIN_SHIFT);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(psDst+i), _mm_adds_epi16(d, _mm_packs_epi32(p0, p1)));
+        }
     }
-    else if (nSpeed_ == 100)
+#elif defined(SIMD_NEON)
+    if (nGain_ == GAIN_UNITY)
     {
-        // Nothing to do
+        for ( ; i+8 <= nSamples ; i += 8)
+            vst1q_s16(psDst+i, vqaddq_s16(vld1q_s16(psDst+i), vld1q_s16(psSrc+i)));
     }
-    // Fast?
-    else if (nSpeed_ > 100)
+    else
     {
-        int nScale = nSpeed_/100;
-        nSize_ = (nSize_/nScale) & ~(SAMPLE_BLOCK-1);
+        int16x4_t g = vdup_n_s16(static_cast<int16_t>(nGain_));
+
+        for ( ; i+8 <= nSamples ; i += 8)
+        {
+            int16x8_t s = vld1q_s16(psSrc+i);
 
-        DWORD *pdwS = reinterpret_cast<DWORD*>(pb_);
-        DWORD *pdwD = pdwS;
+            // Form the 32-bit products, then scale back down with saturation
+            int16x4_t s0 = vqshrn_n_s32(vmull_s16(vget_low_s16(s), g), GAIN_SHIFT);
+            int16x4_t s1 = vqshrn_n_s32(vmull_s16(vget_high_s16(s), g), GAIN_SHIFT);
 
-        // Skip the required number of samples
-        for (int i = 0 ; i < nSize_ ; i += SAMPLE_BLOCK, pdwS += nScale)
-            *pdwD++ = *pdwS;
+            vst1q_s16(psDst+i, vqaddq_s16(vld1q_s16(psDst+i), vcombine_s16(s0, s1)));
+        }
     }
+#endif
+
+    // Mix any remaining samples
+    for ( ; i < nSamples ; i++)
+    {
+        int nSample = psSrc[i];
+
+        // Scale the source, clipping it to the signed range as the SIMD versions do
+        if (nGain_ != GAIN_UNITY)
+        {
+            nSample = (nSample * nGain_) >> GAIN_SHIFT;
+            nSample = std::max(-32768, std::min(nSample, 32767));
+        }
 
-    return nSize_;
+        // Add and clip to the signed range
+        nSample += psDst[i];
+        nSample = std::min(nSample, 32767);
+        nSample = std::max(-32768, nSample);
+
+        psDst[i] = static_cast<int16_t>(nSample);
+    }
 }
+
@@ -25,11 +25,17 @@
 #include "SAA1099.h"
 #include "BlipBuffer.h"
 
-#define SAMPLE_FREQ			44100
+#define SAMPLE_FREQ_DEFAULT	44100
+#define SAMPLE_FREQ_MIN		11025
+#define SAMPLE_FREQ_MAX		96000		// Sample buffers are sized for the highest rate
 #define SAMPLE_BITS			16
 #define SAMPLE_CHANNELS		2
 #define SAMPLE_BLOCK		(SAMPLE_BITS*SAMPLE_CHANNELS/8)
 
+const int GAIN_SHIFT = 8;                   // Mixer gains are 8.8 fixed-point
+const int GAIN_UNITY = 1 << GAIN_SHIFT;
+const int GAIN_MAX = 4 * GAIN_UNITY;        // Highest gain, well within the 16-bit SIMD multipliers
+
 
 class Sound
 {
@@ -39,41 +45,97 @@ class Sound
 
         static void Silence ();
         static void FrameUpdate ();
+
+        static int GetSampleFreq ();
+        static void SetReset (bool fReset_);
 };
 
+// Sound chip register write or reset change, logged for synthesis at frame end
+typedef struct
+{
+    DWORD dwTime;           // CPU cycle counter at the time of the write
+    int nSample;            // DAC sample position at the time of the write
+    WORD wPort;
+    BYTE bVal;
+    bool fWrite;            // false for a change of reset state, which has no port write
+    bool fReset;            // reset state from this point on
+} SOUNDWRITE;
+
+const int MAX_SOUND_WRITES = 4096;          // Logged writes before synthesis is forced to catch up
+
 class CSoundDevice : public CIoDevice
 {
     public:
         CSoundDevice ();
         CSoundDevice (const CSoundDevice &) = delete;
         void operator= (const CSoundDevice &) = delete;
-        virtual ~CSoundDevice () { delete[] m_pbFrameSample; }
+        virtual ~CSoundDevice () { delete[] m_pbFrameSample; delete[] m_pWrites; }
 
     public:
         int GetSampleCount () { return m_nSamplesThisFrame; }
         BYTE *GetSampleBuffer () { return m_pbFrameSample; }
+        int GetWriteCount () const { return m_nWrites; }
+
+        int GetGain () const { return m_nGain; }
+        void SetGain (int nGain_) { m_nGain = std::max(0, std::min(nGain_, GAIN_MAX)); }
+
+        virtual void SetSampleFreq (int /*nFreq_*/) { }
+        virtual void FrameSkip ();
+
+        void LogReset (bool fReset_);
+
+    protected:
+        SOUNDWRITE *NewWrite ();
+        void LogWrite (WORD wPort_, BYTE bVal_);
+        void Replay (int nSamples_, DWORD dwTime_);
+        void ApplyWrites ();
+
+        virtual void Generate (int /*nSamples_*/, DWORD /*dwTime_*/) { }
+        virtual void Write (WORD /*wPort_*/, BYTE /*bVal_*/) { }
 
     protected:
         int m_nSamplesThisFrame = 0;
+        int m_nGain = GAIN_UNITY;
         BYTE *m_pbFrameSample = nullptr;
+
+        SOUNDWRITE *m_pWrites = nullptr;
+        int m_nWrites = 0;
+        bool m_fReset = false;              // reset state at the current replay position
 };
 
+// Band-limited SAA output is generated from the chip clocked at 1MHz (6 T-states per tick)
+const int SAA_TICK_RATE = 1000000;
+const int TSTATES_PER_SAA_TICK = REAL_TSTATES_PER_SECOND / SAA_TICK_RATE;
+const int SAA_BLIP_RANGE = 6336;            // maximum combined channel level
+
 class CSAA final : public CSoundDevice
 {
     public:
-        CSAA () { m_pSAASound = new CSAASound(SAMPLE_FREQ); }
+        CSAA ();
         CSAA (const CSAA &) = delete;
         void operator= (const CSAA &) = delete;
-        ~CSAA () { delete m_pSAASound; }
+        ~CSAA () { delete m_pSAASound; delete m_pSAABlip; }
 
     public:
-        void Update (bool fFrameEnd_);
         void FrameEnd () override;
+        void FrameSkip () override;
+        void SetSampleFreq (int nFreq_) override;
 
         void Out (WORD wPort_, BYTE bVal_) override;
 
     protected:
-        CSAASound *m_pSAASound = nullptr;
+        void Generate (int nSamples_, DWORD dwTime_) override;
+        void GenerateBlip (DWORD dwTime_);
+        void Write (WORD wPort_, BYTE bVal_) override;
+
+    protected:
+        CSAASound *m_pSAASound = nullptr;   // point-sampled at the output rate
+        CSAASound *m_pSAABlip = nullptr;    // ticked at SAA_TICK_RATE for band-limited output
+        bool m_fBlip = false;
+        int m_nTicksThisFrame = 0;
+
+        Blip_Buffer buf_left {}, buf_right {};
+        Blip_Synth<blip_med_quality,SAA_BLIP_RANGE> synth_left {}, synth_right {};
 };
 
 
@@ -85,8 +147,9 @@ class CDAC final : public CSoundDevice
     public:
         void Reset () override;
 
-        void Update (bool fFrameEnd_);
         void FrameEnd () override;
+        void FrameSkip () override { FrameEnd(); }
+        void SetSampleFreq (int nFreq_) override;
 
         void OutputLeft (BYTE bVal_);
         void OutputRight (BYTE bVal_);
@@ -20,22 +20,43 @@
 
 // Notes:
 //  Currently supports read-write access of uncompressed files, gzipped
-//  files, and read-only zip archive access.
+//  files, and zip archives.
+//
+//  Uncompressed files are memory-mapped where possible, so disk images can
+//  be used in place without a separate copy. The mapping is copy-on-write,
+//  so changes stay private until written back with WriteAt(), and the file
+//  is left untouched if they're never saved.
 //
 //  Access to real standard format disks is also supported where a
 //  Floppy.cpp implementation exists.
+//
+//  Compressed images are inflated on demand, with restart points recorded
+//  at intervals so any offset can be reached without inflating from the
+//  start. Saving recompresses the whole image, which the disk writer does
+//  in the background. Zip archives are rebuilt with the image replaced and
+//  the other members copied as they are.
+//
+//  Overlay streams hold a private copy of the image, with changes going to
+//  an overlay file rather than the image itself (see Overlay.cpp).
 
 // Todo:
 //  - remove 32K file test done on zip archives (add a container layer?)
-//  - maybe add support for updating zip archives
 
 #include "SimCoupe.h"
 #include "Stream.h"
 
 #include "Disk.h"
 #include "Floppy.h"
+#include "Overlay.h"
 #include "Util.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CStream::CStream (const char* pcszPath_, bool fReadOnly_/*=false*/)
@@ -88,7 +109,7 @@ CStream::~CStream ()
 
             // Ok, so open and use the first file in the zip and use that
             if (unzOpenCurrentFile(hfZip) == UNZ_OK)
-                return new CZipStream(hfZip, pcszPath_, true/*fReadOnly_*/);  // ZIPs are currently read-only
+                return new CZipStream(hfZip, pcszPath_, fReadOnly_);
         }
 
         // Failed to open the first file, so close the zip
@@ -105,7 +126,7 @@ CStream::~CStream ()
             BYTE abSig[sizeof(GZ_SIGNATURE)];
             if ((fread(abSig, 1, sizeof(abSig), hf) != sizeof(abSig)) || memcmp(abSig, GZ_SIGNATURE, sizeof(abSig)))
 #endif
-                return new CFileStream(hf, pcszPath_, fReadOnly_);
+                return new CMapStream(hf, pcszPath_, fReadOnly_);
 #ifdef USE_ZLIB
             else
             {
@@ -116,13 +137,9 @@ CStream::~CStream ()
                 if (fseek(hf, -4, SEEK_END) == 0 && fread(ab, 1, sizeof(ab), hf) == sizeof(ab))
                     uSize = ((size_t)ab[3] << 24) | ((size_t)ab[2] << 16) | ((size_t)ab[1] << 8) | (size_t)ab[0];
 
-                // Close the file so we can open it through ZLib
+                // Close the file, as the stream reads it on demand
                 fclose(hf);
-
-                // Try to open it as a gzipped file
-                gzFile hfGZip;
-                if ((hfGZip = gzopen(pcszPath_, "rb")))
-                    return new CZLibStream(hfGZip, pcszPath_, uSize, fReadOnly_);
+                return new CZLibStream(pcszPath_, uSize, fReadOnly_);
             }
 #endif  // USE_ZLIB
         }
@@ -132,6 +149,32 @@ CStream::~CStream ()
     return nullptr;
 }
 
+// Replace the stream contents with the supplied data
+bool CStream::Rewrite (const void* pv_, size_t uLen_)
+{
+    bool fWritten = Rewind() && Write(const_cast<void*>(pv_), uLen_) == uLen_;
+    Close();
+
+    return fWritten;
+}
+
+// Read from a given offset, by reading from the start for streams without direct access
+size_t CStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    BYTE ab[4096];
+
+    if (!Rewind())
+        return 0;
+
+    for (size_t uRead ; uOffset_ ; uOffset_ -= uRead)
+    {
+        if (!(uRead = Read(ab, std::min(uOffset_, sizeof(ab)))))
+            return 0;
+    }
+
+    return Read(pv_, uLen_);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CFileStream::CFileStream (FILE* hFile_, const char* pcszPath_, bool fReadOnly_/*=false*/)
@@ -200,6 +243,151 @@ size_t CFileStream::Write (void* pvBuffer_, size_t uLen_)
     return m_hFile ? fwrite(pvBuffer_, 1, uLen_, m_hFile) : 0;
 }
 
+size_t CFileStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    if (m_nMode != modeReading)
+    {
+        Close();
+
+        if ((m_hFile = fopen(m_pszPath, "rb")))
+            m_nMode = modeReading;
+    }
+
+    return (m_hFile && !fseek(m_hFile, static_cast<long>(uOffset_), SEEK_SET)) ? fread(pv_, 1, uLen_, m_hFile) : 0;
+}
+
+// Update part of the file in place, without truncating it
+bool CFileStream::WriteAt (size_t uOffset_, const void* pv_, size_t uLen_)
+{
+    if (m_nMode != modeUpdating)
+    {
+        Close();
+
+        if ((m_hFile = fopen(m_pszPath, "r+b")))
+            m_nMode = modeUpdating;
+    }
+
+    return m_hFile && !fseek(m_hFile, static_cast<long>(uOffset_), SEEK_SET) &&
+           fwrite(pv_, 1, uLen_, m_hFile) == uLen_ && !fflush(m_hFile);
+}
+
+// Write the new contents to a temporary file, then swap it for the original
+bool CFileStream::Rewrite (const void* pv_, size_t uLen_)
+{
+    Close();
+
+    std::string strTemp = std::string(m_pszPath) + ".tmp";
+    FILE* hf = fopen(strTemp.c_str(), "wb");
+    if (!hf)
+        return false;
+
+    bool fWritten = fwrite(pv_, 1, uLen_, hf) == uLen_ && !fflush(hf);
+#ifndef _WIN32
+    fWritten = fWritten && !fsync(fileno(hf));
+#endif
+    fWritten = !fclose(hf) && fWritten;
+
+    return CommitTempFile(strTemp.c_str(), m_pszPath, fWritten);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CMapStream::CMapStream (FILE* hFile_, const char* pcszPath_, bool fReadOnly_/*=false*/)
+    : CFileStream(hFile_, pcszPath_, fReadOnly_)
+{
+    Map();
+
+    // The file handle isn't needed while we have the mapping
+    if (m_pbMap)
+        CFileStream::Close();
+}
+
+// Map the whole file, falling back on regular file access if that fails
+void CMapStream::Map ()
+{
+    if (!m_uSize)
+        return;
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(m_pszPath, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        HANDLE hMapping = CreateFileMappingA(hFile, nullptr, m_fReadOnly ? PAGE_READONLY : PAGE_WRITECOPY, 0, 0, nullptr);
+        if (hMapping)
+        {
+            // The view keeps the mapping alive once the handles are closed
+            m_pbMap = static_cast<BYTE*>(MapViewOfFile(hMapping, m_fReadOnly ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, m_uSize));
+            CloseHandle(hMapping);
+        }
+
+        CloseHandle(hFile);
+    }
+#else
+    int fd = open(m_pszPath, O_RDONLY);
+    if (fd != -1)
+    {
+        void* pv = mmap(nullptr, m_uSize, PROT_READ | (m_fReadOnly ? 0 : PROT_WRITE), MAP_PRIVATE, fd, 0);
+        m_pbMap = (pv != MAP_FAILED) ? static_cast<BYTE*>(pv) : nullptr;
+        close(fd);
+    }
+#endif
+}
+
+void CMapStream::Unmap ()
+{
+    if (m_pbMap)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_pbMap);
+#else
+        munmap(m_pbMap, m_uSize);
+#endif
+        m_pbMap = nullptr;
+    }
+}
+
+bool CMapStream::Rewind ()
+{
+    m_uPos = 0;
+    return CFileStream::Rewind();
+}
+
+size_t CMapStream::Read (void* pvBuffer_, size_t uLen_)
+{
+    if (!m_pbMap)
+        return CFileStream::Read(pvBuffer_, uLen_);
+
+    size_t uRead = std::min(m_uSize-m_uPos, uLen_);
+    memcpy(pvBuffer_, m_pbMap+m_uPos, uRead);
+    m_uPos += uRead;
+    return uRead;
+}
+
+size_t CMapStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    if (!m_pbMap)
+        return CFileStream::ReadAt(uOffset_, pv_, uLen_);
+
+    size_t uRead = (uOffset_ < m_uSize) ? std::min(m_uSize-uOffset_, uLen_) : 0;
+    memcpy(pv_, m_pbMap+uOffset_, uRead);
+    return uRead;
+}
+
+size_t CMapStream::Write (void* pvBuffer_, size_t uLen_)
+{
+    // Writing truncates the file, so the mapping must go first
+    Unmap();
+    return CFileStream::Write(pvBuffer_, uLen_);
+}
+
+bool CMapStream::Rewrite (const void* pv_, size_t uLen_)
+{
+    // The original file is replaced, so we can't keep using its mapping
+    Unmap();
+    return CFileStream::Rewrite(pv_, uLen_);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CMemStream::CMemStream (void* pv_, size_t uLen_, const char* pcszPath_)
@@ -236,6 +424,13 @@ size_t CMemStream::Read (void* pvBuffer_, size_t uLen_)
     return uRead;
 }
 
+size_t CMemStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    size_t uRead = (uOffset_ < m_uSize) ? std::min(m_uSize-uOffset_, uLen_) : 0;
+    memcpy(pv_, m_pbData+uOffset_, uRead);
+    return uRead;
+}
+
 size_t CMemStream::Write (void* /*pvBuffer_*/, size_t /*uLen_*/)
 {
     m_nMode = modeWriting;
@@ -244,11 +439,400 @@ size_t CMemStream::Write (void* /*pvBuffer_*/, size_t /*uLen_*/)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+COverlayStream::COverlayStream (CStream* pBase_, COverlay* pOverlay_)
+    : CStream(pBase_->GetPath(), false), m_pBase(pBase_), m_pOverlay(pOverlay_)
+{
+    m_pszFile = strdup(pBase_->GetFile());
+}
+
+COverlayStream::~COverlayStream ()
+{
+    delete m_pBase;
+    delete m_pOverlay;
+    delete[] m_pbData;
+}
+
+// Open an image with changes going to its overlay, leaving the image itself untouched
+/*static*/ CStream* COverlayStream::Open (const char* pcszPath_)
+{
+    CStream* pBase = CStream::Open(pcszPath_, true);
+    if (!pBase)
+        return nullptr;
+
+    size_t uSize = pBase->GetSize();
+    uint64_t ullChunks = (std::max(uSize, OVERLAY_STREAM_SIZE) + OVERLAY_CHUNK_SIZE-1) / OVERLAY_CHUNK_SIZE;
+
+    // Without an overlay the image can only be used read-only
+    COverlay* pOverlay = COverlay::Open(pcszPath_, OVERLAY_CHUNK_SIZE, ullChunks, uSize);
+    if (!pOverlay)
+        return pBase;
+
+    COverlayStream* pStream = new COverlayStream(pBase, pOverlay);
+    if (!pStream->Load())
+        delete pStream, pStream = nullptr;
+
+    return pStream;
+}
+
+// Read the full base image and apply the overlay changes, which is cheap for floppy-sized images
+bool COverlayStream::Load ()
+{
+    size_t uBaseSize = m_pBase->GetSize();
+
+    if (!Resize(uBaseSize) || !m_pBase->Rewind() || m_pBase->Read(m_pbData, uBaseSize) != uBaseSize)
+        return false;
+
+    m_pBase->Close();
+
+    // The overlay size wins, as the image may have been rewritten with a different size
+    if (!Resize(static_cast<size_t>(m_pOverlay->GetSize())))
+        return false;
+
+    for (uint64_t u = m_pOverlay->NextChunk(0) ; u * OVERLAY_CHUNK_SIZE < m_uSize ; u = m_pOverlay->NextChunk(u+1))
+    {
+        if (!m_pOverlay->Read(u, m_pbData + u * OVERLAY_CHUNK_SIZE))
+            return false;
+    }
+
+    return true;
+}
+
+// Set the image size, keeping the data in whole chunks with anything beyond the end zeroed
+bool COverlayStream::Resize (size_t uSize_)
+{
+    size_t uAlloc = (uSize_ + OVERLAY_CHUNK_SIZE-1) / OVERLAY_CHUNK_SIZE * OVERLAY_CHUNK_SIZE;
+
+    if (uAlloc > m_pOverlay->GetChunks() * OVERLAY_CHUNK_SIZE)
+        return false;
+
+    if (!m_pbData || uAlloc != m_uAlloc)
+    {
+        BYTE* pb = new BYTE[std::max(uAlloc, OVERLAY_CHUNK_SIZE)]();
+
+        if (m_pbData)
+            memcpy(pb, m_pbData, std::min(m_uSize, uSize_));
+
+        delete[] m_pbData;
+        m_pbData = pb;
+        m_uAlloc = uAlloc;
+    }
+
+    memset(m_pbData + std::min(m_uSize, uSize_), 0, m_uAlloc - std::min(m_uSize, uSize_));
+    m_uSize = uSize_;
+    return true;
+}
+
+
+void COverlayStream::Close ()
+{
+    m_nMode = modeClosed;
+    m_pBase->Close();
+}
+
+bool COverlayStream::Rewind ()
+{
+    m_uPos = 0;
+    return true;
+}
+
+size_t COverlayStream::Read (void* pvBuffer_, size_t uLen_)
+{
+    if (m_nMode != modeReading)
+    {
+        m_nMode = modeReading;
+        m_uPos = 0;
+    }
+
+    size_t uRead = std::min(m_uSize-m_uPos, uLen_);
+    memcpy(pvBuffer_, m_pbData+m_uPos, uRead);
+    m_uPos += uRead;
+    return uRead;
+}
+
+size_t COverlayStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    size_t uRead = (uOffset_ < m_uSize) ? std::min(m_uSize-uOffset_, uLen_) : 0;
+    memcpy(pv_, m_pbData+uOffset_, uRead);
+    return uRead;
+}
+
+size_t COverlayStream::Write (void* /*pvBuffer_*/, size_t /*uLen_*/)
+{
+    // Changes must go through WriteAt or Rewrite, so they can be tracked
+    return 0;
+}
+
+bool COverlayStream::WriteAt (size_t uOffset_, const void* pv_, size_t uLen_)
+{
+    if (!uLen_)
+        return true;
+
+    if (uOffset_+uLen_ > m_uSize && (!Resize(uOffset_+uLen_) || !m_pOverlay->SetSize(m_uSize)))
+        return false;
+
+    memcpy(m_pbData+uOffset_, pv_, uLen_);
+
+    uint64_t ullFirst = uOffset_ / OVERLAY_CHUNK_SIZE, ullLast = (uOffset_+uLen_-1) / OVERLAY_CHUNK_SIZE;
+    return m_pOverlay->Write(ullFirst, static_cast<UINT>(ullLast-ullFirst+1), m_pbData + ullFirst*OVERLAY_CHUNK_SIZE);
+}
+
+// Replace the image contents, writing only the chunks that have changed
+bool COverlayStream::Rewrite (const void* pv_, size_t uLen_)
+{
+    size_t uOldSize = m_uSize;
+    if (!Resize(uLen_))
+        return false;
+
+    const BYTE* pb = static_cast<const BYTE*>(pv_);
+    size_t uChunks = (uLen_ + OVERLAY_CHUNK_SIZE-1) / OVERLAY_CHUNK_SIZE;
+    bool fRet = true;
+
+    for (size_t u = 0, uStart = 0 ; u <= uChunks ; u++)
+    {
+        bool fChanged = false;
+
+        if (u < uChunks)
+        {
+            size_t uOffset = u * OVERLAY_CHUNK_SIZE, uLen = std::min(uLen_ - uOffset, OVERLAY_CHUNK_SIZE);
+
+            // Chunks not wholly within the old image are always written, as the base may differ beyond its end
+            fChanged = uOffset + OVERLAY_CHUNK_SIZE > uOldSize || memcmp(m_pbData + uOffset, pb + uOffset, uLen);
+            memcpy(m_pbData + uOffset, pb + uOffset, uLen);
+        }
+
+        // Write each run of changed chunks as a single block
+        if (!fChanged)
+        {
+            if (u > uStart)
+                fRet &= m_pOverlay->Write(uStart, static_cast<UINT>(u-uStart), m_pbData + uStart*OVERLAY_CHUNK_SIZE);
+
+            uStart = u+1;
+        }
+    }
+
+    return m_pOverlay->SetSize(uLen_) && fRet;
+}
+
+
+// Save the current image over the base image, leaving an empty overlay
+bool COverlayStream::CommitOverlay ()
+{
+    // Nothing to do if the image is unchanged
+    if (m_pOverlay->IsEmpty() && m_uSize == m_pBase->GetSize())
+        return true;
+
+    // The base stream is read-only, so use a fresh stream for the update
+    CStream* pStream = CStream::Open(m_pszPath, false);
+    bool fRet = pStream && !pStream->IsReadOnly() && pStream->Rewrite(m_pbData, m_uSize);
+    delete pStream;
+
+    if (!fRet)
+        return false;
+
+    // Switch to the updated image, which now matches our data
+    delete m_pBase;
+    m_pBase = CStream::Open(m_pszPath, true);
+
+    return m_pBase && m_pOverlay->Reset();
+}
+
+// Throw away all changes, leaving the caller to reload the base image
+bool COverlayStream::DiscardOverlay ()
+{
+    return m_pOverlay->Reset() && m_pOverlay->SetSize(m_pBase->GetSize());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 #ifdef USE_ZLIB
 
-CZLibStream::CZLibStream (gzFile hFile_, const char* pcszPath_, size_t uSize_, bool fReadOnly_/*=false*/)
-    : CStream(pcszPath_, fReadOnly_), m_hFile(hFile_), m_uSize(uSize_)
+CInflater::CInflater (const char* pcszPath_, long lStart_, int nWindowBits_)
+    : m_strPath(pcszPath_), m_nWindowBits(nWindowBits_)
+{
+    // The start of the data is always a restart point
+    m_mapPoints[0] = { 0, lStart_, 0, nullptr };
+
+    if (m_nWindowBits != INFLATE_STORED)
+    {
+        m_pbWindow = new BYTE[INFLATE_WINDOW]();
+        m_pbIn = new BYTE[INFLATE_WINDOW];
+    }
+}
+
+CInflater::~CInflater ()
+{
+    Close();
+
+    if (m_fActive)
+        inflateEnd(&m_zs);
+
+    for (auto &it : m_mapPoints)
+        delete[] it.second.pbWindow;
+
+    delete[] m_pbWindow;
+    delete[] m_pbIn;
+}
+
+// Release the file handle, keeping the restart points and the current position for later reads
+void CInflater::Close ()
+{
+    if (m_hFile)
+    {
+        fclose(m_hFile);
+        m_hFile = nullptr;
+    }
+}
+
+
+// Prepare to inflate from a restart point
+bool CInflater::Start (const INFLATE_POINT &sPoint_)
+{
+    if (m_fActive)
+        inflateEnd(&m_zs);
+
+    // Points after the start are mid-way through raw deflate data
+    m_zs = z_stream();
+    m_fActive = inflateInit2(&m_zs, sPoint_.pbWindow ? -MAX_WBITS : m_nWindowBits) == Z_OK;
+    if (!m_fActive)
+        return false;
+
+    // Feed in any bits from the partial byte before the point
+    if (sPoint_.nBits)
+    {
+        int nByte = fseek(m_hFile, sPoint_.lIn-1, SEEK_SET) ? EOF : fgetc(m_hFile);
+        if (nByte == EOF || inflatePrime(&m_zs, sPoint_.nBits, nByte >> (8-sPoint_.nBits)) != Z_OK)
+            return false;
+    }
+
+    if (sPoint_.pbWindow)
+    {
+        if (inflateSetDictionary(&m_zs, sPoint_.pbWindow, INFLATE_WINDOW) != Z_OK)
+            return false;
+
+        // Keep the history, as it's needed for any later restart points
+        memcpy(m_pbWindow, sPoint_.pbWindow, INFLATE_WINDOW);
+    }
+
+    m_lIn = sPoint_.lIn;
+    m_uOut = sPoint_.uOut;
+    m_uWindowPos = 0;
+    m_fEnd = false;
+
+    return true;
+}
+
+// Record a restart point at the current position, which must be a deflate block boundary
+void CInflater::AddPoint ()
+{
+    INFLATE_POINT sPoint = { m_uOut, m_lIn - static_cast<long>(m_zs.avail_in), m_zs.data_type & 7, new BYTE[INFLATE_WINDOW] };
+
+    // Unwrap the circular window so the oldest data comes first
+    memcpy(sPoint.pbWindow, m_pbWindow + m_uWindowPos, INFLATE_WINDOW - m_uWindowPos);
+    memcpy(sPoint.pbWindow + INFLATE_WINDOW - m_uWindowPos, m_pbWindow, m_uWindowPos);
+
+    m_mapPoints[m_uOut] = sPoint;
+}
+
+// Inflate from the current position into the supplied buffer, or discard the data if there's no buffer
+size_t CInflater::Inflate (BYTE* pb_, size_t uLen_)
+{
+    size_t uDone = 0;
+
+    while (uDone < uLen_ && !m_fEnd)
+    {
+        if (!m_zs.avail_in)
+        {
+            size_t uRead = fseek(m_hFile, m_lIn, SEEK_SET) ? 0 : fread(m_pbIn, 1, INFLATE_WINDOW, m_hFile);
+            if (!uRead)
+                break;
+
+            m_zs.next_in = m_pbIn;
+            m_zs.avail_in = static_cast<uInt>(uRead);
+            m_lIn += static_cast<long>(uRead);
+        }
+
+        // Inflate into the history window, stopping at block boundaries so restart points can be added
+        BYTE* pbOut = m_pbWindow + m_uWindowPos;
+        uInt uAvail = static_cast<uInt>(std::min(INFLATE_WINDOW - m_uWindowPos, uLen_ - uDone));
+        m_zs.next_out = pbOut;
+        m_zs.avail_out = uAvail;
+
+        int nRet = inflate(&m_zs, Z_BLOCK);
+        size_t uOut = uAvail - m_zs.avail_out;
+
+        if (pb_)
+            memcpy(pb_ + uDone, pbOut, uOut);
+
+        uDone += uOut;
+        m_uOut += uOut;
+        m_uWindowPos = (m_uWindowPos + uOut) % INFLATE_WINDOW;
+
+        if (nRet == Z_STREAM_END)
+            m_fEnd = true, m_uSize = m_uOut;
+        else if (nRet != Z_OK && (nRet != Z_BUF_ERROR || m_zs.avail_in))
+        {
+            TRACE("!!! Inflate failed at %lu in %s\n", static_cast<unsigned long>(m_uOut), m_strPath.c_str());
+            inflateEnd(&m_zs);
+            m_fActive = false;
+            break;
+        }
+        else if ((m_zs.data_type & 128) && !(m_zs.data_type & 64) && m_uOut >= m_mapPoints.rbegin()->first + INFLATE_SPAN)
+            AddPoint();
+    }
+
+    return uDone;
+}
+
+
+size_t CInflater::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    if (!m_hFile && !(m_hFile = fopen(m_strPath.c_str(), "rb")))
+        return 0;
+
+    // Uncompressed data is read directly
+    if (m_nWindowBits == INFLATE_STORED)
+    {
+        long lOffset = m_mapPoints[0].lIn + static_cast<long>(uOffset_);
+        return fseek(m_hFile, lOffset, SEEK_SET) ? 0 : fread(pv_, 1, uLen_, m_hFile);
+    }
+
+    // Restart from the nearest point before the offset, unless carrying on is closer
+    auto it = --m_mapPoints.upper_bound(uOffset_);
+    if (!m_fActive || uOffset_ < m_uOut || it->first > m_uOut)
+    {
+        if (!Start(it->second))
+            return 0;
+    }
+
+    // Skip to the offset, then inflate the data
+    size_t uSkip = uOffset_ - m_uOut;
+    if (uSkip && Inflate(nullptr, uSkip) != uSkip)
+        return 0;
+
+    return m_fActive ? Inflate(static_cast<BYTE*>(pv_), uLen_) : 0;
+}
+
+// Determine the uncompressed size by inflating to the end, which also indexes the data for later reads
+size_t CInflater::GetSize ()
 {
+    if (m_uSize || m_nWindowBits == INFLATE_STORED)
+        return m_uSize;
+
+    size_t uEnd = m_mapPoints.rbegin()->first;
+    while (!m_fEnd && ReadAt(uEnd, nullptr, INFLATE_SPAN))
+        uEnd = m_uOut;
+
+    return m_uSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CZLibStream::CZLibStream (const char* pcszPath_, size_t uSize_, bool fReadOnly_/*=false*/)
+    : CStream(pcszPath_, fReadOnly_)
+{
+    m_uSize = uSize_;
+    m_pInflater = new CInflater(pcszPath_, 0, MAX_WBITS+16);
+
     for (const char* p = pcszPath_ ; *p ; p++)
     {
         if (*p == PATH_SEPARATOR)
@@ -261,41 +845,40 @@ CZLibStream::CZLibStream (gzFile hFile_, const char* pcszPath_, size_t uSize_, b
     m_pszFile = strdup(szFile);
 }
 
+CZLibStream::~CZLibStream ()
+{
+    Close();
+    delete m_pInflater;
+}
+
 void CZLibStream::Close ()
 {
     if (m_hFile)
     {
         gzclose(m_hFile);
         m_hFile = nullptr;
-        m_nMode = modeClosed;
     }
+
+    if (m_pInflater)
+        m_pInflater->Close();
+
+    m_nMode = modeClosed;
 }
 
 
 size_t CZLibStream::GetSize ()
 {
     // Do we need to determine the size?
-    if (!m_uSize && IsOpen())
-    {
-        long lPos = gztell(m_hFile);
-        gzrewind(m_hFile);
-
-        BYTE ab[512];
-        int nRead;
-
-        do {
-            m_uSize += (nRead = gzread(m_hFile, ab, sizeof(ab)));
-        } while (nRead > 0);
-
-        gzseek(m_hFile, lPos, SEEK_SET);
-    }
+    if (!m_uSize && m_pInflater)
+        m_uSize = m_pInflater->GetSize();
 
     return m_uSize;
 }
 
 bool CZLibStream::Rewind ()
 {
-    return !IsOpen() || !gzrewind(m_hFile);
+    m_uPos = 0;
+    return true;
 }
 
 size_t CZLibStream::Read (void* pvBuffer_, size_t uLen_)
@@ -305,13 +888,18 @@ size_t CZLibStream::Read (void* pvBuffer_, size_t uLen_)
         // Close the file, if open for writing
         Close();
 
-        // Open the file for writing, using compression if the source file did
-        if ((m_hFile = gzopen(m_pszPath, "rb")))
-            m_nMode = modeReading;
+        m_nMode = modeReading;
+        m_uPos = 0;
     }
 
-    int nRead = m_hFile ? gzread(m_hFile, pvBuffer_, static_cast<unsigned>(uLen_)) : 0;
-    return (nRead == -1) ? 0 : static_cast<size_t>(nRead);
+    size_t uRead = ReadAt(m_uPos, pvBuffer_, uLen_);
+    m_uPos += uRead;
+    return uRead;
+}
+
+size_t CZLibStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    return m_pInflater ? m_pInflater->ReadAt(uOffset_, pv_, uLen_) : 0;
 }
 
 size_t CZLibStream::Write (void* pvBuffer_, size_t uLen_)
@@ -324,15 +912,245 @@ size_t CZLibStream::Write (void* pvBuffer_, size_t uLen_)
         // Open the file for writing, using compression if the source file did
         if ((m_hFile = gzopen(m_pszPath, "wb9")))
             m_nMode = modeWriting;
+
+        // The old restart points don't apply to the new contents
+        delete m_pInflater;
+        m_pInflater = new CInflater(m_pszPath, 0, MAX_WBITS+16);
+        m_uSize = 0;
     }
 
     return m_hFile ? gzwrite(m_hFile, pvBuffer_, static_cast<unsigned>(uLen_)) : 0;
 }
 
+// Compress the new contents to a temporary file, then swap it for the original
+bool CZLibStream::Rewrite (const void* pv_, size_t uLen_)
+{
+    Close();
+
+    std::string strTemp = std::string(m_pszPath) + ".tmp";
+    gzFile hf = gzopen(strTemp.c_str(), "wb9");
+    if (!hf)
+        return false;
+
+    bool fWritten = gzwrite(hf, const_cast<void*>(pv_), static_cast<unsigned>(uLen_)) == static_cast<int>(uLen_);
+    fWritten = (gzclose(hf) == Z_OK) && fWritten;
+
+    if (!CommitTempFile(strTemp.c_str(), m_pszPath, fWritten))
+        return false;
+
+    // Start a fresh index for the new contents
+    delete m_pInflater;
+    m_pInflater = new CInflater(m_pszPath, 0, MAX_WBITS+16);
+    m_uSize = uLen_;
+
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
+// Little-endian field helpers for zip headers
+static void PutWord (std::string &str_, UINT u_)
+{
+    str_ += static_cast<char>(u_ & 0xff);
+    str_ += static_cast<char>((u_ >> 8) & 0xff);
+}
+
+static void PutDword (std::string &str_, DWORD dw_)
+{
+    PutWord(str_, dw_ & 0xffff);
+    PutWord(str_, dw_ >> 16);
+}
+
+// Remove any zip64 block from an extra field, as the header fields it extends are always written in full
+static std::string StripZip64 (const std::string &strExtra_)
+{
+    std::string str;
+
+    for (size_t u = 0 ; u + 4 <= strExtra_.length() ; )
+    {
+        UINT uId = static_cast<BYTE>(strExtra_[u]) | (static_cast<BYTE>(strExtra_[u+1]) << 8);
+        size_t uBlock = 4 + (static_cast<BYTE>(strExtra_[u+2]) | (static_cast<BYTE>(strExtra_[u+3]) << 8));
+
+        if (uId != 0x0001)
+            str += strExtra_.substr(u, uBlock);
+
+        u += uBlock;
+    }
+
+    return str;
+}
+
+// Build a zip header, using the central directory layout if an offset is given
+static std::string ZipHeader (const unz_file_info &sInfo_, const std::string &strName_, const std::string &strExtra_,
+                              const std::string &strComment_="", long lOffset_=-1)
+{
+    std::string str;
+    bool fCentral = lOffset_ >= 0;
+
+    PutDword(str, fCentral ? 0x02014b50 : 0x04034b50);
+    if (fCentral) PutWord(str, sInfo_.version);
+    PutWord(str, sInfo_.version_needed);
+    PutWord(str, sInfo_.flag);
+    PutWord(str, sInfo_.compression_method);
+    PutDword(str, sInfo_.dosDate);
+    PutDword(str, sInfo_.crc);
+    PutDword(str, sInfo_.compressed_size);
+    PutDword(str, sInfo_.uncompressed_size);
+    PutWord(str, static_cast<UINT>(strName_.length()));
+    PutWord(str, static_cast<UINT>(strExtra_.length()));
+
+    if (fCentral)
+    {
+        PutWord(str, static_cast<UINT>(strComment_.length()));
+        PutWord(str, 0);    // Disk 0
+        PutWord(str, sInfo_.internal_fa);
+        PutDword(str, sInfo_.external_fa);
+        PutDword(str, static_cast<DWORD>(lOffset_));
+    }
+
+    return str + strName_ + strExtra_ + (fCentral ? strComment_ : "");
+}
+
+// Rebuild a zip archive with one member replaced by new data, copying the other members as they are.
+// Extra fields and comments are kept, except for the replaced member's extra fields (which describe
+// the old data) and any zip64 blocks.
+static bool RewriteZip (const char* pcszPath_, const char* pcszMember_, const void* pv_, size_t uLen_)
+{
+    unzFile hfZip = unzOpen(pcszPath_);
+    if (!hfZip)
+        return false;
+
+    std::string strTemp = std::string(pcszPath_) + ".tmp";
+    FILE* hf = fopen(strTemp.c_str(), "wb");
+
+    std::string strCentral, strComment;
+    UINT uEntries = 0;
+    bool fWritten = hf != nullptr;
+
+    // Keep the archive comment
+    unz_global_info sGlobal;
+    if (fWritten && unzGetGlobalInfo(hfZip, &sGlobal) == UNZ_OK && sGlobal.size_comment)
+    {
+        strComment.resize(sGlobal.size_comment + 1);
+        fWritten = unzGetGlobalComment(hfZip, &strComment[0], static_cast<uLong>(strComment.size())) == static_cast<int>(sGlobal.size_comment);
+        strComment.resize(sGlobal.size_comment);
+    }
+
+    for (int nRet = unzGoToFirstFile(hfZip) ; fWritten && nRet == UNZ_OK ; nRet = unzGoToNextFile(hfZip), uEntries++)
+    {
+        unz_file_info sInfo;
+        char szName[MAX_PATH];
+        fWritten = unzGetCurrentFileInfo(hfZip, &sInfo, szName, sizeof(szName), nullptr, 0, nullptr, 0) == UNZ_OK;
+
+        BYTE* pbData = nullptr;
+        uLong ulData = 0;
+        std::string strLocalExtra, strCentralExtra, strFileComment;
+
+        if (!fWritten)
+            break;
+
+        // Fetch the central directory extra field and comment
+        strCentralExtra.resize(sInfo.size_file_extra);
+        strFileComment.resize(sInfo.size_file_comment);
+        fWritten = unzGetCurrentFileInfo(hfZip, &sInfo, nullptr, 0,
+                                         sInfo.size_file_extra ? &strCentralExtra[0] : nullptr, sInfo.size_file_extra,
+                                         sInfo.size_file_comment ? &strFileComment[0] : nullptr, sInfo.size_file_comment) == UNZ_OK;
+
+        if (!fWritten)
+            break;
+        else if (!strcmp(szName, pcszMember_))
+        {
+            z_stream zs {};
+            strCentralExtra.clear();
+
+            // Deflate the new image data
+            fWritten = deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            if (fWritten)
+            {
+                pbData = new BYTE[ulData = deflateBound(&zs, static_cast<uLong>(uLen_))];
+                zs.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(pv_));
+                zs.avail_in = static_cast<uInt>(uLen_);
+                zs.next_out = pbData;
+                zs.avail_out = static_cast<uInt>(ulData);
+
+                fWritten = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+                ulData = zs.total_out;
+                deflateEnd(&zs);
+            }
+
+            time_t tNow = time(nullptr);
+            struct tm* ptm = localtime(&tNow);
+
+            sInfo.flag = 0;
+            sInfo.compression_method = Z_DEFLATED;
+            sInfo.crc = crc32(0, reinterpret_cast<const Bytef*>(pv_), static_cast<uInt>(uLen_));
+            sInfo.compressed_size = ulData;
+            sInfo.uncompressed_size = static_cast<uLong>(uLen_);
+            sInfo.dosDate = ((ptm->tm_year-80) << 25) | ((ptm->tm_mon+1) << 21) | (ptm->tm_mday << 16) |
+                            (ptm->tm_hour << 11) | (ptm->tm_min << 5) | (ptm->tm_sec >> 1);
+        }
+        else
+        {
+            int nMethod, nLevel;
+            pbData = new BYTE[(ulData = sInfo.compressed_size) + 1];
+
+            // Copy the compressed data and local extra field unchanged, with the sizes now known up front
+            fWritten = unzOpenCurrentFile2(hfZip, &nMethod, &nLevel, 1) == UNZ_OK;
+            if (fWritten)
+            {
+                int nExtra = unzGetLocalExtrafield(hfZip, nullptr, 0);
+                strLocalExtra.resize(nExtra > 0 ? nExtra : 0);
+
+                fWritten = nExtra >= 0 && (!nExtra || unzGetLocalExtrafield(hfZip, &strLocalExtra[0], nExtra) == nExtra) &&
+                           unzReadCurrentFile(hfZip, pbData, static_cast<unsigned>(ulData)) == static_cast<int>(ulData);
+                unzCloseCurrentFile(hfZip);
+            }
+            sInfo.flag &= ~8;
+        }
+
+        long lOffset = ftell(hf);
+        std::string strLocal = ZipHeader(sInfo, szName, StripZip64(strLocalExtra));
+        strCentral += ZipHeader(sInfo, szName, StripZip64(strCentralExtra), strFileComment, lOffset);
+
+        fWritten = fWritten && lOffset >= 0 && fwrite(strLocal.data(), 1, strLocal.length(), hf) == strLocal.length() &&
+                   fwrite(pbData, 1, ulData, hf) == ulData;
+        delete[] pbData;
+    }
+
+    unzClose(hfZip);
+
+    if (hf)
+    {
+        long lCentral = ftell(hf);
+        std::string strEnd;
+
+        // End of central directory record
+        PutDword(strEnd, 0x06054b50);
+        PutWord(strEnd, 0);
+        PutWord(strEnd, 0);
+        PutWord(strEnd, uEntries);
+        PutWord(strEnd, uEntries);
+        PutDword(strEnd, static_cast<DWORD>(strCentral.length()));
+        PutDword(strEnd, static_cast<DWORD>(lCentral));
+        PutWord(strEnd, static_cast<UINT>(strComment.length()));
+        strEnd += strComment;
+
+        // Larger archives would need the zip64 extensions
+        fWritten = fWritten && uEntries < 0xffff && lCentral >= 0 && lCentral < 0x7fffffff &&
+                   fwrite(strCentral.data(), 1, strCentral.length(), hf) == strCentral.length() &&
+                   fwrite(strEnd.data(), 1, strEnd.length(), hf) == strEnd.length() && !fflush(hf);
+#ifndef _WIN32
+        fWritten = fWritten && !fsync(fileno(hf));
+#endif
+        fWritten = !fclose(hf) && fWritten;
+    }
+
+    return CommitTempFile(strTemp.c_str(), pcszPath_, fWritten);
+}
+
+
 CZipStream::CZipStream (unzFile hFile_, const char* pcszPath_, bool fReadOnly_/*=false*/)
-    : CStream(pcszPath_, fReadOnly_), m_hFile(hFile_)
+    : CStream(pcszPath_, fReadOnly_)
 {
     unz_file_info sInfo;
     char szFile[MAX_PATH+6];
@@ -340,41 +1158,100 @@ CZipStream::CZipStream (unzFile hFile_, const char* pcszPath_, bool fReadOnly_/*
     // Get details of the current file
     if (unzGetCurrentFileInfo(hFile_, &sInfo, szFile, MAX_PATH, nullptr, 0, nullptr, 0) == UNZ_OK)
     {
-        m_uSize = sInfo.uncompressed_size;
+        m_strMember = szFile;
         strcat(szFile, " (zip)");
         m_pszFile = strdup(szFile);
     }
+
+    // The data is read directly from the archive, so we don't need the zip handle
+    unzCloseCurrentFile(hFile_);
+    unzClose(hFile_);
+
+    Locate();
 }
 
-void CZipStream::Close ()
+CZipStream::~CZipStream ()
 {
-    if (m_hFile)
+    Close();
+    delete m_pInflater;
+}
+
+// Find the image data in the archive, and prepare an inflater to read it
+bool CZipStream::Locate ()
+{
+    delete m_pInflater, m_pInflater = nullptr;
+
+    unzFile hfZip = unzOpen(m_pszPath);
+    if (!hfZip)
+        return false;
+
+    unz_file_info sInfo;
+    if (unzLocateFile(hfZip, m_strMember.c_str(), 1) == UNZ_OK &&
+        unzGetCurrentFileInfo(hfZip, &sInfo, nullptr, 0, nullptr, 0, nullptr, 0) == UNZ_OK &&
+        !(sInfo.flag & 1) && (sInfo.compression_method == 0 || sInfo.compression_method == Z_DEFLATED) &&
+        unzOpenCurrentFile(hfZip) == UNZ_OK)
     {
-        unzCloseCurrentFile(m_hFile);
-        unzClose(m_hFile);
-        m_hFile = nullptr;
-        m_nMode = modeClosed;
+        long lData = static_cast<long>(unzGetCurrentFileZStreamPos64(hfZip));
+        m_pInflater = new CInflater(m_pszPath, lData, sInfo.compression_method ? -MAX_WBITS : INFLATE_STORED);
+        m_uSize = sInfo.uncompressed_size;
+
+        unzCloseCurrentFile(hfZip);
     }
+
+    unzClose(hfZip);
+    return m_pInflater != nullptr;
 }
 
-bool CZipStream::Rewind ()
+void CZipStream::Close ()
 {
-    // There's no zip rewind so we close and re-open the current file
-    if (IsOpen())
-        unzCloseCurrentFile(m_hFile);
+    if (m_pInflater)
+        m_pInflater->Close();
 
-    return unzOpenCurrentFile(m_hFile) == UNZ_OK;
+    m_nMode = modeClosed;
+}
+
+bool CZipStream::Rewind ()
+{
+    m_uPos = 0;
+    return m_pInflater != nullptr;
 }
 
 size_t CZipStream::Read (void* pvBuffer_, size_t uLen_)
 {
-    return unzReadCurrentFile(m_hFile, pvBuffer_, static_cast<unsigned>(uLen_));
+    if (m_nMode != modeReading)
+    {
+        m_nMode = modeReading;
+        m_uPos = 0;
+    }
+
+    size_t uRead = ReadAt(m_uPos, pvBuffer_, uLen_);
+    m_uPos += uRead;
+    return uRead;
+}
+
+size_t CZipStream::ReadAt (size_t uOffset_, void* pv_, size_t uLen_)
+{
+    // Stored data has no end marker, so limit reads to the member size
+    uLen_ = (uOffset_ < m_uSize) ? std::min(uLen_, m_uSize-uOffset_) : 0;
+    return m_pInflater ? m_pInflater->ReadAt(uOffset_, pv_, uLen_) : 0;
 }
 
 size_t CZipStream::Write (void* /*pvBuffer_*/, size_t /*uLen_*/)
 {
-    // Currently there's no support for zip writing (yet)
+    // Archives can only be updated with a complete image
     return 0;
 }
 
+// Rebuild the archive with the new image data, leaving any other members untouched
+bool CZipStream::Rewrite (const void* pv_, size_t uLen_)
+{
+    Close();
+
+    bool fWritten = RewriteZip(m_pszPath, m_strMember.c_str(), pv_, uLen_);
+
+    // The member data will have moved, so find it again
+    Locate();
+    return fWritten;
+}
+
 #endif  // USE_ZLIB
@@ -21,6 +21,11 @@
 #ifndef STREAM_H
 #define STREAM_H
 
+class COverlay;
+
+const size_t OVERLAY_CHUNK_SIZE = 512;                  // Overlay chunk size for image streams
+const size_t OVERLAY_STREAM_SIZE = 16*1024*1024;        // Minimum overlay capacity, allowing for images that grow
+
 class CStream
 {
     public:
@@ -43,9 +48,20 @@ class CStream
         virtual bool Rewind () = 0;
         virtual size_t Read (void* pvBuffer_, size_t uLen_) = 0;
         virtual size_t Write (void* pvBuffer_, size_t uLen_) = 0;
+        virtual size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_);
+
+        virtual bool CanWriteAt () const { return false; }
+        virtual bool WriteAt (size_t /*uOffset_*/, const void* /*pv_*/, size_t /*uLen_*/) { return false; }
+        virtual bool Rewrite (const void* pv_, size_t uLen_);
+
+        virtual BYTE* GetMapping () { return nullptr; }
+
+        virtual bool HasOverlay () const { return false; }
+        virtual bool CommitOverlay () { return false; }
+        virtual bool DiscardOverlay () { return false; }
 
     protected:
-        enum { modeClosed, modeReading, modeWriting };
+        enum { modeClosed, modeReading, modeWriting, modeUpdating };
         int m_nMode = modeClosed;
 
         char *m_pszPath = nullptr;
@@ -54,7 +70,7 @@ class CStream
         size_t m_uSize = 0;
 };
 
-class CFileStream final : public CStream
+class CFileStream : public CStream
 {
     public:
         CFileStream (FILE* hFile_, const char* pcszPath_, bool fReadOnly_=false);
@@ -70,11 +86,46 @@ class CFileStream final : public CStream
         bool Rewind () override;
         size_t Read (void* pvBuffer_, size_t uLen_) override;
         size_t Write (void* pvBuffer_, size_t uLen_) override;
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_) override;
+
+        bool CanWriteAt () const override { return !m_fReadOnly; }
+        bool WriteAt (size_t uOffset_, const void* pv_, size_t uLen_) override;
+        bool Rewrite (const void* pv_, size_t uLen_) override;
 
     protected:
         FILE *m_hFile = nullptr;
 };
 
+class CMapStream final : public CFileStream
+{
+    public:
+        CMapStream (FILE* hFile_, const char* pcszPath_, bool fReadOnly_=false);
+        CMapStream (const CMapStream &) = delete;
+        void operator= (const CMapStream &) = delete;
+        ~CMapStream () { Unmap(); }
+
+    public:
+        bool IsOpen () const override { return m_pbMap || CFileStream::IsOpen(); }
+
+    public:
+        bool Rewind () override;
+        size_t Read (void* pvBuffer_, size_t uLen_) override;
+        size_t Write (void* pvBuffer_, size_t uLen_) override;
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_) override;
+        bool Rewrite (const void* pv_, size_t uLen_) override;
+
+        // Changes made through the mapping are private, and must be saved using WriteAt
+        BYTE* GetMapping () override { return m_pbMap; }
+
+    protected:
+        void Map ();
+        void Unmap ();
+
+    protected:
+        BYTE *m_pbMap = nullptr;    // Copy-on-write file mapping, or nullptr for regular file access
+        size_t m_uPos = 0;
+};
+
 class CMemStream final : public CStream
 {
     public:
@@ -91,27 +142,120 @@ class CMemStream final : public CStream
         bool Rewind () override;
         size_t Read (void* pvBuffer_, size_t uLen_) override;
         size_t Write (void* pvBuffer_, size_t uLen_) override;
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_) override;
 
     protected:
         BYTE *m_pbData = nullptr;
         size_t m_uPos = 0;
 };
 
+class COverlayStream final : public CStream
+{
+    public:
+        COverlayStream (CStream* pBase_, COverlay* pOverlay_);
+        COverlayStream (const COverlayStream &) = delete;
+        void operator= (const COverlayStream &) = delete;
+        ~COverlayStream ();
+
+    public:
+        static CStream* Open (const char* pcszPath_);
+
+    public:
+        bool IsOpen () const override { return m_pbData != nullptr; }
+
+    public:
+        void Close () override;
+        bool Rewind () override;
+        size_t Read (void* pvBuffer_, size_t uLen_) override;
+        size_t Write (void* pvBuffer_, size_t uLen_) override;
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_) override;
+
+        bool CanWriteAt () const override { return true; }
+        bool WriteAt (size_t uOffset_, const void* pv_, size_t uLen_) override;
+        bool Rewrite (const void* pv_, size_t uLen_) override;
+
+        bool HasOverlay () const override { return true; }
+        bool CommitOverlay () override;
+        bool DiscardOverlay () override;
+
+    protected:
+        bool Load ();
+        bool Resize (size_t uSize_);
+
+    protected:
+        CStream *m_pBase = nullptr;         // Read-only base image
+        COverlay *m_pOverlay = nullptr;     // Changed chunks
+        BYTE *m_pbData = nullptr;           // Current image data, as whole chunks with a zeroed tail
+        size_t m_uAlloc = 0;
+        size_t m_uPos = 0;
+};
+
 
 #ifdef USE_ZLIB
 
 const BYTE GZ_SIGNATURE[] = { 0x1f, 0x8b };
 
+const size_t INFLATE_SPAN = 256*1024;   // Uncompressed bytes between inflate restart points
+const size_t INFLATE_WINDOW = 32768;    // Deflate history needed to restart mid-stream
+const int INFLATE_STORED = 0;           // Window bits value for uncompressed data
+
+// Point in deflate data where inflation can be restarted
+typedef struct
+{
+    size_t uOut;            // Uncompressed offset
+    long lIn;               // Compressed offset of the first whole byte
+    int nBits;              // Bits needed from the byte before lIn (0-7)
+    BYTE *pbWindow;         // Uncompressed data preceding the point, or nullptr for the start of the data
+}
+INFLATE_POINT;
+
+// Random access to deflate data, using restart points recorded as the data is inflated
+class CInflater final
+{
+    public:
+        CInflater (const char* pcszPath_, long lStart_, int nWindowBits_);
+        CInflater (const CInflater &) = delete;
+        void operator= (const CInflater &) = delete;
+        ~CInflater ();
+
+    public:
+        void Close ();
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_);
+        size_t GetSize ();
+
+    protected:
+        bool Start (const INFLATE_POINT &sPoint_);
+        size_t Inflate (BYTE* pb_, size_t uLen_);
+        void AddPoint ();
+
+    protected:
+        std::string m_strPath;
+        FILE *m_hFile = nullptr;
+        int m_nWindowBits = 0;                  // Window bits for the start of the data (gzip or raw), or INFLATE_STORED
+        std::map<size_t, INFLATE_POINT> m_mapPoints;    // Restart points, by uncompressed offset
+
+        z_stream m_zs {};
+        bool m_fActive = false;                 // Inflater state is initialised?
+        bool m_fEnd = false;                    // Reached the end of the data?
+        long m_lIn = 0;                         // Compressed offset of the next input to read
+        size_t m_uOut = 0;                      // Uncompressed offset of the next output
+        size_t m_uSize = 0;                     // Uncompressed size, once the end has been seen
+
+        BYTE *m_pbWindow = nullptr;             // Circular buffer of recent output
+        size_t m_uWindowPos = 0;
+        BYTE *m_pbIn = nullptr;                 // Compressed input buffer
+};
+
 class CZLibStream final : public CStream
 {
     public:
-        CZLibStream (gzFile hFile_, const char* pcszPath_, size_t uSize_=0, bool fReadOnly_=false);
+        CZLibStream (const char* pcszPath_, size_t uSize_=0, bool fReadOnly_=false);
         CZLibStream (const CZLibStream &) = delete;
         void operator= (const CZLibStream &) = delete;
-        ~CZLibStream () { Close(); }
+        ~CZLibStream ();
 
     public:
-        bool IsOpen () const override { return m_hFile != nullptr; }
+        bool IsOpen () const override { return m_pInflater != nullptr; }
         size_t GetSize () override;
 
     public:
@@ -119,10 +263,14 @@ class CZLibStream final : public CStream
         bool Rewind () override;
         size_t Read (void* pvBuffer_, size_t uLen_) override;
         size_t Write (void* pvBuffer_, size_t uLen_) override;
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_) override;
+
+        bool Rewrite (const void* pv_, size_t uLen_) override;
 
     protected:
-        gzFile m_hFile = nullptr;
-        size_t m_uSize = 0;
+        CInflater *m_pInflater = nullptr;       // Indexed reader, kept across Close() to reuse its restart points
+        gzFile m_hFile = nullptr;               // Compressed output, when writing
+        size_t m_uPos = 0;
 };
 
 class CZipStream final : public CStream
@@ -131,19 +279,27 @@ class CZipStream final : public CStream
         CZipStream (unzFile hFile_, const char* pcszPath_, bool fReadOnly_=false);
         CZipStream (const CZipStream &) = delete;
         void operator= (const CZipStream &) = delete;
-        ~CZipStream () { Close(); }
+        ~CZipStream ();
 
     public:
-        bool IsOpen () const  override { return m_hFile != nullptr; }
+        bool IsOpen () const override { return m_pInflater != nullptr; }
 
     public:
         void Close () override;
         bool Rewind () override;
         size_t Read (void* pvBuffer_, size_t uLen_) override;
         size_t Write (void* pvBuffer_, size_t uLen_) override;
+        size_t ReadAt (size_t uOffset_, void* pv_, size_t uLen_) override;
+
+        bool Rewrite (const void* pv_, size_t uLen_) override;
+
+    protected:
+        bool Locate ();
 
     protected:
-        unzFile m_hFile = nullptr;
+        std::string m_strMember;                // Name of the image in the archive
+        CInflater *m_pInflater = nullptr;
+        size_t m_uPos = 0;
 };
 
 #endif  // USE_ZLIB
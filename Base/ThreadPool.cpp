@@ -0,0 +1,118 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// ThreadPool.cpp: Worker threads for splitting work into parallel bands
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Run() divides a range of items into equal bands, one per thread.  The
+//  calling thread processes the first band itself, and returns only once
+//  the workers have completed the remaining bands.
+
+#include "SimCoupe.h"
+#include "ThreadPool.h"
+
+CThreadPool::CThreadPool (int nMaxThreads_/*=MAX_POOL_THREADS*/)
+{
+    // One thread per core, with the caller taking one share of the work
+    int nCores = static_cast<int>(std::thread::hardware_concurrency());
+    m_nThreads = std::min(nCores, nMaxThreads_) - 1;
+
+    if (m_nThreads > 0)
+    {
+        m_pThreads = new std::thread[m_nThreads];
+
+        for (int i = 0 ; i < m_nThreads ; i++)
+            m_pThreads[i] = std::thread(&CThreadPool::ThreadProc, this, i+1);
+    }
+    else
+        m_nThreads = 0;
+
+    TRACE("CThreadPool: %d worker threads\n", m_nThreads);
+}
+
+CThreadPool::~CThreadPool ()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fExit = true;
+    }
+
+    m_cvStart.notify_all();
+
+    for (int i = 0 ; i < m_nThreads ; i++)
+        m_pThreads[i].join();
+
+    delete[] m_pThreads;
+}
+
+
+// Process nItems_ items, split into bands across all threads
+void CThreadPool::Run (PFNBANDPROC pfnBand_, void *pvParam_, int nItems_)
+{
+    // Not worth waking the workers if there's too little to share
+    if (!m_nThreads || nItems_ <= m_nThreads)
+    {
+        pfnBand_(pvParam_, 0, nItems_);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pfnBand = pfnBand_;
+        m_pvParam = pvParam_;
+        m_nItems = nItems_;
+        m_nPending = m_nThreads;
+        m_uJob++;
+    }
+
+    m_cvStart.notify_all();
+
+    // Process the first band ourselves
+    pfnBand_(pvParam_, 0, nItems_ / (m_nThreads+1));
+
+    // Wait for the workers to finish the rest
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvDone.wait(lock, [this] { return !m_nPending; });
+}
+
+void CThreadPool::ThreadProc (int nBand_)
+{
+    unsigned int uLastJob = 0;
+
+    for (;;)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvStart.wait(lock, [&] { return m_fExit || m_uJob != uLastJob; });
+
+        if (m_fExit)
+            break;
+
+        uLastJob = m_uJob;
+        lock.unlock();
+
+        // Determine our share of the items
+        int nBands = m_nThreads+1;
+        int nFrom = m_nItems * nBand_ / nBands;
+        int nTo = m_nItems * (nBand_+1) / nBands;
+        m_pfnBand(m_pvParam, nFrom, nTo);
+
+        lock.lock();
+        if (!--m_nPending)
+            m_cvDone.notify_one();
+    }
+}
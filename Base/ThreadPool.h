@@ -0,0 +1,63 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// ThreadPool.h: Worker threads for splitting work into parallel bands
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+const int MAX_POOL_THREADS = 8;     // Upper limit on worker threads, regardless of CPU count
+
+typedef void (*PFNBANDPROC)(void *pvParam_, int nFrom_, int nTo_);
+
+class CThreadPool final
+{
+    public:
+        CThreadPool (int nMaxThreads_=MAX_POOL_THREADS);
+        CThreadPool (const CThreadPool &) = delete;
+        void operator= (const CThreadPool &) = delete;
+        ~CThreadPool ();
+
+    public:
+        int GetThreads () const { return m_nThreads+1; }
+        void Run (PFNBANDPROC pfnBand_, void *pvParam_, int nItems_);
+
+    protected:
+        void ThreadProc (int nBand_);
+
+    protected:
+        int m_nThreads = 0;                     // Number of workers, excluding the calling thread
+        std::thread *m_pThreads = nullptr;
+
+        std::mutex m_mutex {};
+        std::condition_variable m_cvStart {}, m_cvDone {};
+
+        PFNBANDPROC m_pfnBand = nullptr;        // Current job details
+        void *m_pvParam = nullptr;
+        int m_nItems = 0;
+
+        unsigned int m_uJob = 0;                // Incremented for each new job
+        int m_nPending = 0;                     // Workers still busy with the current job
+        bool m_fExit = false;
+};
+
+#endif  // THREADPOOL_H
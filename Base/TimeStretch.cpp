@@ -0,0 +1,244 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// TimeStretch.cpp: WSOLA time-stretching for non-100% running speeds
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  The input is cut into overlapping sequences, which are stepped through
+//  at the running speed but output at normal speed, so the pitch is kept.
+//  Each sequence start is chosen from a small seek window to best match the
+//  tail of the previous sequence, which is then cross-faded into it.
+//
+//  The stretched output is queued, and a frame's worth at the current speed
+//  is returned for each input frame, to keep the frame rate steady.
+
+#include "SimCoupe.h"
+#include "TimeStretch.h"
+
+#include "Sound.h"
+
+#include <cmath>
+
+const int SEQUENCE_MS = 40;     // Length of each stretched sequence
+const int SEEK_MS = 15;         // Range searched for the best overlap position
+const int OVERLAP_MS = 8;       // Cross-fade length between sequences
+
+const int MIN_SPEED = 50;       // Same range as the speed option
+const int MAX_SPEED = 1000;
+
+
+CTimeStretch::CTimeStretch (int nFreq_)
+{
+    m_nSequence = nFreq_ * SEQUENCE_MS / 1000;
+    m_nSeek = nFreq_ * SEEK_MS / 1000;
+    m_nOverlap = nFreq_ * OVERLAP_MS / 1000;
+
+    // Room for a full search window plus a generous frame of new input
+    m_nInMax = m_nSequence + m_nSeek + nFreq_/10;
+    m_nOutMax = nFreq_/2;
+
+    m_psIn = new short[m_nInMax*SAMPLE_CHANNELS];
+    m_psOut = new short[m_nOutMax*SAMPLE_CHANNELS];
+    m_psMid = new short[m_nOverlap*SAMPLE_CHANNELS];
+
+    m_pnMono = new int[m_nSeek + m_nOverlap*2];
+    m_pllEnergy = new int64_t[m_nSeek + m_nOverlap + 1];
+
+    Reset();
+}
+
+CTimeStretch::~CTimeStretch ()
+{
+    delete[] m_psIn;
+    delete[] m_psOut;
+    delete[] m_psMid;
+    delete[] m_pnMono;
+    delete[] m_pllEnergy;
+}
+
+
+void CTimeStretch::Reset ()
+{
+    m_fActive = false;
+    m_nIn = 0;
+    m_nSkipPending = m_nSkipFrac = m_nOutFrac = 0;
+
+    // The first sequence fades in from silence
+    memset(m_psMid, 0, m_nOverlap*SAMPLE_BLOCK);
+
+    // Prime the output with enough silence to cover the first search window
+    m_nOut = m_nSequence + m_nSeek;
+    memset(m_psOut, 0, m_nOut*SAMPLE_BLOCK);
+}
+
+// Stretch a frame of audio in-place, returning the new size in bytes
+int CTimeStretch::Process (BYTE *pb_, int nSize_, int nMaxSize_, int nSpeed_)
+{
+    // Normal speed passes straight through, ready to start afresh if needed
+    if (nSpeed_ == 100)
+    {
+        if (m_fActive)
+            Reset();
+
+        return nSize_;
+    }
+
+    nSpeed_ = std::max(nSpeed_, MIN_SPEED);
+    nSpeed_ = std::min(nSpeed_, MAX_SPEED);
+    m_fActive = true;
+
+    int nSamples = nSize_ / SAMPLE_BLOCK;
+    AddInput(reinterpret_cast<short*>(pb_), nSamples);
+    Stretch(nSpeed_);
+
+    // Determine how much output the frame is worth at the current speed
+    m_nOutFrac += nSamples * 100;
+    int nWant = m_nOutFrac / nSpeed_;
+    m_nOutFrac %= nSpeed_;
+    nWant = std::min(nWant, nMaxSize_ / SAMPLE_BLOCK);
+
+    int nAvail = std::min(nWant, m_nOut);
+    memcpy(pb_, m_psOut, nAvail*SAMPLE_BLOCK);
+    memmove(m_psOut, m_psOut + nAvail*SAMPLE_CHANNELS, (m_nOut-nAvail)*SAMPLE_BLOCK);
+    m_nOut -= nAvail;
+
+    // Hold the last sample over any shortfall
+    short *ps = reinterpret_cast<short*>(pb_);
+    for (int i = nAvail ; i < nWant ; i++)
+    {
+        for (int c = 0 ; c < SAMPLE_CHANNELS ; c++)
+            ps[i*SAMPLE_CHANNELS + c] = i ? ps[(i-1)*SAMPLE_CHANNELS + c] : 0;
+    }
+
+    return nWant * SAMPLE_BLOCK;
+}
+
+
+void CTimeStretch::AddInput (const short *ps_, int nSamples_)
+{
+    // Drop input already stepped over by the last sequence
+    int nSkip = std::min(m_nSkipPending, nSamples_);
+    ps_ += nSkip*SAMPLE_CHANNELS;
+    nSamples_ -= nSkip;
+    m_nSkipPending -= nSkip;
+
+    nSamples_ = std::min(nSamples_, m_nInMax - m_nIn);
+    memcpy(m_psIn + m_nIn*SAMPLE_CHANNELS, ps_, nSamples_*SAMPLE_BLOCK);
+    m_nIn += nSamples_;
+}
+
+void CTimeStretch::Stretch (int nSpeed_)
+{
+    int nOutput = m_nSequence - m_nOverlap;
+
+    // Process sequences while we have a full search window
+    while (m_nIn >= m_nSequence + m_nSeek)
+    {
+        const short *ps = m_psIn + FindBestOffset()*SAMPLE_CHANNELS;
+
+        // Make room if the output isn't being consumed (shouldn't happen)
+        if (m_nOut + nOutput > m_nOutMax)
+        {
+            int nDrop = m_nOut + nOutput - m_nOutMax;
+            memmove(m_psOut, m_psOut + nDrop*SAMPLE_CHANNELS, (m_nOut-nDrop)*SAMPLE_BLOCK);
+            m_nOut -= nDrop;
+        }
+
+        short *pd = m_psOut + m_nOut*SAMPLE_CHANNELS;
+
+        // Cross-fade from the previous sequence tail into the new sequence
+        for (int i = 0 ; i < m_nOverlap ; i++)
+        {
+            for (int c = 0 ; c < SAMPLE_CHANNELS ; c++)
+            {
+                int n = i*SAMPLE_CHANNELS + c;
+                pd[n] = static_cast<short>((m_psMid[n]*(m_nOverlap-i) + ps[n]*i) / m_nOverlap);
+            }
+        }
+
+        // Copy the body, and keep the tail for the next overlap
+        memcpy(pd + m_nOverlap*SAMPLE_CHANNELS, ps + m_nOverlap*SAMPLE_CHANNELS, (m_nSequence - m_nOverlap*2)*SAMPLE_BLOCK);
+        memcpy(m_psMid, ps + nOutput*SAMPLE_CHANNELS, m_nOverlap*SAMPLE_BLOCK);
+        m_nOut += nOutput;
+
+        // Step through the input at the running speed, deferring any skip beyond what we have
+        m_nSkipFrac += nOutput * nSpeed_;
+        int nSkip = m_nSkipFrac / 100;
+        m_nSkipFrac %= 100;
+
+        int nSkipNow = std::min(nSkip, m_nIn);
+        memmove(m_psIn, m_psIn + nSkipNow*SAMPLE_CHANNELS, (m_nIn-nSkipNow)*SAMPLE_BLOCK);
+        m_nIn -= nSkipNow;
+        m_nSkipPending += nSkip - nSkipNow;
+    }
+}
+
+// Find the offset in the seek window that best continues the previous sequence
+int CTimeStretch::FindBestOffset ()
+{
+    int nLen = m_nSeek + m_nOverlap;
+    int *pnMid = m_pnMono + nLen;
+
+    // Mono copies of the search region and the previous tail, with running energy of the region
+    m_pllEnergy[0] = 0;
+    for (int i = 0 ; i < nLen ; i++)
+    {
+        int n = m_psIn[i*2] + m_psIn[i*2+1];
+        m_pnMono[i] = n;
+        m_pllEnergy[i+1] = m_pllEnergy[i] + static_cast<int64_t>(n)*n;
+    }
+
+    for (int i = 0 ; i < m_nOverlap ; i++)
+        pnMid[i] = m_psMid[i*2] + m_psMid[i*2+1];
+
+    // Coarse search first, then refine around the best match
+    int nBest = 0;
+    double dBest = Correlate(0);
+
+    for (int i = 4 ; i < m_nSeek ; i += 4)
+    {
+        double d = Correlate(i);
+        if (d > dBest)
+            nBest = i, dBest = d;
+    }
+
+    int nFrom = std::max(nBest-3, 0), nTo = std::min(nBest+3, m_nSeek-1);
+    for (int i = nFrom ; i <= nTo ; i++)
+    {
+        double d = Correlate(i);
+        if (d > dBest)
+            nBest = i, dBest = d;
+    }
+
+    return nBest;
+}
+
+// Normalised correlation of the previous tail with the region at the given offset
+double CTimeStretch::Correlate (int nOffset_) const
+{
+    const int *pnRegion = m_pnMono + nOffset_;
+    const int *pnMid = m_pnMono + m_nSeek + m_nOverlap;
+
+    // Every other sample is plenty for matching, and halves the cost
+    int64_t llSum = 0;
+    for (int i = 0 ; i < m_nOverlap ; i += 2)
+        llSum += static_cast<int64_t>(pnRegion[i]) * pnMid[i];
+
+    int64_t llEnergy = m_pllEnergy[nOffset_ + m_nOverlap] - m_pllEnergy[nOffset_];
+    return llSum / sqrt(static_cast<double>(llEnergy) + 1.0);
+}
@@ -0,0 +1,59 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// TimeStretch.h: WSOLA time-stretching for non-100% running speeds
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef TIMESTRETCH_H
+#define TIMESTRETCH_H
+
+class CTimeStretch final
+{
+    public:
+        CTimeStretch (int nFreq_);
+        CTimeStretch (const CTimeStretch &) = delete;
+        void operator= (const CTimeStretch &) = delete;
+        ~CTimeStretch ();
+
+    public:
+        void Reset ();
+        int Process (BYTE *pb_, int nSize_, int nMaxSize_, int nSpeed_);
+
+    protected:
+        void AddInput (const short *ps_, int nSamples_);
+        void Stretch (int nSpeed_);
+        int FindBestOffset ();
+        double Correlate (int nOffset_) const;
+
+    protected:
+        int m_nSequence = 0, m_nSeek = 0, m_nOverlap = 0;   // Window sizes, in samples
+
+        short *m_psIn = nullptr;            // Stereo input samples waiting to be stretched
+        int m_nIn = 0, m_nInMax = 0;
+        short *m_psOut = nullptr;           // Stretched stereo samples waiting to be played
+        int m_nOut = 0, m_nOutMax = 0;
+        short *m_psMid = nullptr;           // Sequence tail to overlap with the next sequence
+
+        int *m_pnMono = nullptr;            // Mono search region, followed by the mono sequence tail
+        int64_t *m_pllEnergy = nullptr;
+
+        bool m_fActive = false;             // Stretching since the last reset?
+        int m_nSkipPending = 0;             // Input to skip that hasn't arrived yet
+        int m_nSkipFrac = 0, m_nOutFrac = 0;
+};
+
+#endif  // TIMESTRETCH_H
@@ -143,13 +143,90 @@ const char *AbbreviateSize (uint64_t ullSize_)
 }
 
 
-// CRC-CCITT for id/data checksums, with bit and byte order swapped
-WORD CrcBlock (const void* pcv_, size_t uLen_, WORD wCRC_/*=0xffff*/)
+// Positional reads and writes, returning the number of bytes transferred, or -1 on error
+int ReadAt (int hFile_, off_t lOffset_, void* pv_, UINT uLen_)
+{
+#ifdef _WIN32
+    if (_lseeki64(hFile_, lOffset_, SEEK_SET) < 0)
+        return -1;
+
+    return _read(hFile_, pv_, uLen_);
+#else
+    UINT uDone = 0;
+
+    while (uDone < uLen_)
+    {
+        ssize_t nRead = pread(hFile_, reinterpret_cast<BYTE*>(pv_) + uDone, uLen_ - uDone, lOffset_ + uDone);
+
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        else if (nRead < 0)
+            return -1;
+        else if (!nRead)
+            break;
+
+        uDone += static_cast<UINT>(nRead);
+    }
+
+    return static_cast<int>(uDone);
+#endif
+}
+
+bool WriteAt (int hFile_, off_t lOffset_, const void* pv_, UINT uLen_)
 {
-    static WORD awCRC[256];
+#ifdef _WIN32
+    return _lseeki64(hFile_, lOffset_, SEEK_SET) >= 0 && _write(hFile_, pv_, uLen_) == static_cast<int>(uLen_);
+#else
+    UINT uDone = 0;
 
-    // Build the table if not already built
-    if (!awCRC[1])
+    while (uDone < uLen_)
+    {
+        ssize_t nWritten = pwrite(hFile_, reinterpret_cast<const BYTE*>(pv_) + uDone, uLen_ - uDone, lOffset_ + uDone);
+
+        if (nWritten < 0 && errno == EINTR)
+            continue;
+        else if (nWritten <= 0)
+            return false;
+
+        uDone += static_cast<UINT>(nWritten);
+    }
+
+    return true;
+#endif
+}
+
+
+// Name a temporary file to build a replacement for the given file, unique to this process
+std::string GetTempFile (const char* pcszPath_)
+{
+#ifdef _WIN32
+    int nPid = _getpid();
+#else
+    int nPid = static_cast<int>(getpid());
+#endif
+    return std::string(pcszPath_) + "." + std::to_string(nPid) + ".tmp";
+}
+
+// Replace the original file with a completed temporary file, so a failed save never leaves it truncated
+bool CommitTempFile (const char* pcszTemp_, const char* pcszPath_, bool fWritten_)
+{
+#ifdef _WIN32
+    if (fWritten_ && MoveFileExA(pcszTemp_, pcszPath_, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH))
+        return true;
+#else
+    if (fWritten_ && !rename(pcszTemp_, pcszPath_))
+        return true;
+#endif
+
+    remove(pcszTemp_);
+    return false;
+}
+
+
+// Slicing-by-8 tables for CrcBlock, where [n][b] is the CRC of byte b followed by n zero bytes
+struct CRC_TABLES
+{
+    CRC_TABLES ()
     {
         for (int i = 0 ; i < 256 ; i++)
         {
@@ -159,14 +236,38 @@ WORD CrcBlock (const void* pcv_, size_t uLen_, WORD wCRC_/*=0xffff*/)
             for (int j = 0 ; j < 8 ; j++)
                 w = (w << 1) ^ ((w & 0x8000) ? 0x1021 : 0);
 
-            awCRC[i] = w;
+            aw[0][i] = w;
+        }
+
+        // Each further table pushes the entry from the previous one through a zero byte
+        for (int n = 1 ; n < 8 ; n++)
+        {
+            for (int i = 0 ; i < 256 ; i++)
+                aw[n][i] = (aw[n-1][i] << 8) ^ aw[0][aw[n-1][i] >> 8];
         }
     }
 
-    // Update the CRC with each byte in the block
+    WORD aw[8][256];
+};
+
+// CRC-CCITT for id/data checksums, with bit and byte order swapped
+WORD CrcBlock (const void* pcv_, size_t uLen_, WORD wCRC_/*=0xffff*/)
+{
+    static const CRC_TABLES sTables;
+    const WORD (*aw)[256] = sTables.aw;
+
     const BYTE* pb = reinterpret_cast<const BYTE*>(pcv_);
+
+    // Process 8 bytes at a time, with the current CRC folded into the first two
+    for ( ; uLen_ >= 8 ; uLen_ -= 8, pb += 8)
+    {
+        wCRC_ = aw[7][pb[0] ^ (wCRC_ >> 8)] ^ aw[6][pb[1] ^ (wCRC_ & 0xff)] ^
+                aw[5][pb[2]] ^ aw[4][pb[3]] ^ aw[3][pb[4]] ^ aw[2][pb[5]] ^ aw[1][pb[6]] ^ aw[0][pb[7]];
+    }
+
+    // Update the CRC with each remaining byte
     while (uLen_--)
-        wCRC_ = (wCRC_ << 8) ^ awCRC[((wCRC_ >> 8) ^ *pb++) & 0xff];
+        wCRC_ = (wCRC_ << 8) ^ aw[0][((wCRC_ >> 8) ^ *pb++) & 0xff];
 
     // Return the updated CRC
     return wCRC_;
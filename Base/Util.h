@@ -36,6 +36,10 @@ void Message (eMsgType eType_, const char* pcszFormat_, ...);
 BYTE GetSizeCode (UINT uSize_);
 const char *AbbreviateSize (uint64_t ullSize_);
 WORD CrcBlock (const void* pcv_, size_t uLen_, WORD wCRC_=0xffff);
+int ReadAt (int hFile_, off_t lOffset_, void* pv_, UINT uLen_);
+bool WriteAt (int hFile_, off_t lOffset_, const void* pv_, UINT uLen_);
+std::string GetTempFile (const char* pcszPath_);
+bool CommitTempFile (const char* pcszTemp_, const char* pcszPath_, bool fWritten_);
 void PatchBlock (BYTE *pb_, BYTE *pbPatch_);
 UINT TPeek (const BYTE *pb_);
 
@@ -102,8 +102,8 @@ bool Start (bool fSegment_)
 
     // Write the RIFF header
     WriteWaveValue(SAMPLE_CHANNELS, riff.wave.fmt.Channels, sizeof(riff.wave.fmt.Channels));
-    WriteWaveValue(SAMPLE_FREQ, riff.wave.fmt.SamplesPerSec, sizeof(riff.wave.fmt.SamplesPerSec));
-    WriteWaveValue(SAMPLE_FREQ*SAMPLE_BLOCK, riff.wave.fmt.AvgBytesPerSec, sizeof(riff.wave.fmt.AvgBytesPerSec));
+    WriteWaveValue(Sound::GetSampleFreq(), riff.wave.fmt.SamplesPerSec, sizeof(riff.wave.fmt.SamplesPerSec));
+    WriteWaveValue(Sound::GetSampleFreq()*SAMPLE_BLOCK, riff.wave.fmt.AvgBytesPerSec, sizeof(riff.wave.fmt.AvgBytesPerSec));
     WriteWaveValue(SAMPLE_BLOCK, riff.wave.fmt.BlockAlign, sizeof(riff.wave.fmt.BlockAlign));
     WriteWaveValue(SAMPLE_BITS, riff.wave.fmt.BitsPerSample, sizeof(riff.wave.fmt.BitsPerSample));
     fwrite(&riff, sizeof(riff), 1, f);
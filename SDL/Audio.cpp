@@ -23,6 +23,10 @@
 #include "Audio.h"
 #include "Sound.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "CPU.h"
 #include "IO.h"
 #include "Options.h"
@@ -31,13 +35,32 @@
 
 #define SAMPLE_BUFFER_SIZE	2048
 
-static Uint8 *m_pbStart, *m_pbEnd, *m_pbNow;
-static int m_nSampleBufferSize;
-static Uint32 uLastTime;
+const int PACER_SPIN_NS = 500000;       // Spin for the final 0.5ms before a frame deadline, rather than sleeping
+const int PACER_MAX_ADJUST = 10000;     // Limit frame period adjustments to +/-1% (in ppm)
+const int RESAMPLE_MAX_ADJUST = 500;    // Limit sample rate adjustments to +/-500ppm
+
+// Single-producer/single-consumer ring of sample data, shared with the SDL audio callback.
+// The head and tail offsets run freely, and are masked to the power-of-2 buffer size for access.
+static Uint8 *pbRing;
+static UINT uRingMask, uCapacity;
+static std::atomic<UINT> uHead, uTail;
+static std::atomic<bool> fDiscard;
+static std::atomic<UINT> uUnderruns, uOverruns;
+static UINT uTargetFill, uFrameBytes;
+
+static int64_t llNextFrame;     // Deadline for the current frame to end, in ns
+static int nFillError;          // Smoothed buffer fill error, in bytes*16
+
+static Uint8 *pbResample;       // Rate-adjusted sample data
+static int nResampleSize;
+static uint64_t ullResamplePos; // Fractional input position carried between frames (32.32 fixed-point)
+static short asLast[SAMPLE_CHANNELS];
 
 static bool InitSDLSound ();
 static void ExitSDLSound ();
 static void SoundCallback (void *pvParam_, Uint8 *pbStream_, int nLen_);
+static void WaitFrame (int nLength_);
+static int Resample (const Uint8 *pbData_, int nLength_, int nPpm_);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -51,17 +74,31 @@ bool Audio::Init (bool fFirstInit_/*=false*/)
     // All sound disabled?
     if (!GetOption(sound))
         TRACE("Sound disabled, nothing to initialise\n");
-    else if (!InitSDLSound())
-        TRACE("Sound initialisation failed\n");
     else
     {
-        int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND)+1;
-        int nBufferedFrames = (SAMPLE_BUFFER_SIZE/nSamplesPerFrame) + 1 + GetOption(latency);
+        int nSamplesPerFrame = (Sound::GetSampleFreq() / EMULATED_FRAMES_PER_SECOND)+1;
+        uFrameBytes = nSamplesPerFrame * SAMPLE_BLOCK;
+
+        // The callback takes whole device blocks, so aim to hold half a block plus the latency frames.
+        // Rate control keeps the level steady, so only a little headroom is needed above that.
+        uTargetFill = (SAMPLE_BUFFER_SIZE/2)*SAMPLE_BLOCK + uFrameBytes*std::max(GetOption(latency), 1);
+        uCapacity = uTargetFill + (SAMPLE_BUFFER_SIZE/2)*SAMPLE_BLOCK + uFrameBytes*2;
 
-        m_nSampleBufferSize = nSamplesPerFrame * SAMPLE_BLOCK * nBufferedFrames;
-        m_pbEnd = (m_pbNow = m_pbStart = new Uint8[m_nSampleBufferSize]) + m_nSampleBufferSize;
+        // The ring itself is rounded up to a power of 2
+        for (uRingMask = 1 ; uRingMask < uCapacity ; uRingMask <<= 1);
+        pbRing = new Uint8[uRingMask--];
 
-        TRACE("Sample buffer size = %d samples\n", m_nSampleBufferSize/SAMPLE_BLOCK);
+        uHead = uTail = 0;
+        fDiscard = false;
+        nFillError = 0;
+        ullResamplePos = 0;
+        memset(asLast, 0, sizeof(asLast));
+
+        TRACE("Sample buffer size = %u samples\n", uCapacity/SAMPLE_BLOCK);
+
+        // Start playback now the buffer is ready for the callback
+        if (!InitSDLSound())
+            TRACE("Sound initialisation failed\n");
     }
 
     // Sound initialisation failure isn't fatal, so always return success
@@ -80,70 +117,74 @@ void Audio::Exit (bool fReInit_/*=false*/)
 
 bool Audio::AddData (Uint8* pbData_, int nLength_)
 {
-    int nSpace = 0;
+    int nFreq = Sound::GetSampleFreq();
+    int nFrameTime = ((nLength_*1000/SAMPLE_BLOCK) + (nFreq/2)) / nFreq;
+    int nFrameLength = nLength_;
+    Uint32 uStart = SDL_GetTicks();
+
+    if (pbRing && IsAvailable())
+    {
+        // Nudge the sample rate to correct any drift in the buffer level, with less data if it's too full
+        int nPpm = (nFillError >> 4) * RESAMPLE_MAX_ADJUST / static_cast<int>(uFrameBytes);
+        nPpm = std::max(-RESAMPLE_MAX_ADJUST, std::min(RESAMPLE_MAX_ADJUST, nPpm));
 
-    // Calculate the frame time (in ms) from the sample data length
-    int nFrameTime = ((nLength_*1000/SAMPLE_BLOCK) + (SAMPLE_FREQ/2)) / SAMPLE_FREQ;
+        nLength_ = Resample(pbData_, nLength_, nPpm);
+        pbData_ = pbResample;
+    }
 
     // Loop until everything has been written
-    while (m_pbNow && nLength_ > 0)
+    while (pbRing && IsAvailable() && nLength_ > 0)
     {
-        SDL_LockAudio();
+        // Only we move the head, but the callback may free more space at any time
+        UINT uHeadNow = uHead.load(std::memory_order_relaxed);
+        UINT uData = uHeadNow - uTail.load(std::memory_order_acquire);
 
-        // Determine the available space
-        nSpace = static_cast<int>(m_pbEnd-m_pbNow);
-        int nAdd = std::min(nSpace, nLength_);
+        // If the buffer has run almost dry (or been discarded), prime it with silence to the target level
+        if (uData < uFrameBytes && !fDiscard)
+        {
+            UINT uSilence = uTargetFill - std::min(uTargetFill, uData + nLength_);
+            UINT uOffset = uHeadNow & uRingMask;
+            UINT uFirst = std::min(uSilence, uRingMask+1 - uOffset);
+            memset(pbRing + uOffset, 0x00, uFirst);
+            memset(pbRing, 0x00, uSilence - uFirst);
+
+            uHead.store(uHeadNow += uSilence, std::memory_order_release);
+            uData += uSilence;
+        }
 
-        // Copy as much as we can
-        memcpy(m_pbNow, pbData_, nAdd);
+        UINT uSpace = uCapacity - uData;
+        UINT uAdd = std::min(uSpace, static_cast<UINT>(nLength_));
 
-        // Adjust for what was added
-        m_pbNow += nAdd;
-        pbData_ += nAdd;
-        nLength_ -= nAdd;
+        // Copy as much as we can, in up to two parts if it wraps the end of the ring
+        UINT uOffset = uHeadNow & uRingMask;
+        UINT uFirst = std::min(uAdd, uRingMask+1 - uOffset);
+        memcpy(pbRing + uOffset, pbData_, uFirst);
+        memcpy(pbRing, pbData_ + uFirst, uAdd - uFirst);
 
-        SDL_UnlockAudio();
+        // Publish the new data to the callback
+        uHead.store(uHeadNow + uAdd, std::memory_order_release);
+
+        // Adjust for what was added
+        pbData_ += uAdd;
+        nLength_ -= uAdd;
 
         // All written?
         if (!nLength_)
             break;
 
+        // If the buffer has been full for over a frame, drop the rest
+        if (static_cast<Sint32>(SDL_GetTicks() - uStart) > nFrameTime)
+        {
+            uOverruns++;
+            break;
+        }
+
         // Wait for more space
         SDL_Delay(1);
     }
 
-    // How long since the frame?
-    Uint32 uNow = SDL_GetTicks();
-    Sint32 nElapsed = static_cast<Sint32>(uNow - uLastTime);
-
-    // If we're too far behind, re-sync
-    if (nElapsed > nFrameTime*2)
-    {
-        uLastTime = uNow;
-    }
-    else
-    {
-        // If we're falling behind, reduce the delay by 1ms
-        if (nSpace > (SAMPLE_BUFFER_SIZE*SAMPLE_BLOCK))
-            nFrameTime--;
-
-        for (;;)
-        {
-            // How long since the last frame?
-            nElapsed = static_cast<Sint32>(SDL_GetTicks() - uLastTime);
-
-            // Have we waited long enough?
-            if (nElapsed >= nFrameTime)
-            {
-                // Adjust for the next frame
-                uLastTime += nFrameTime;
-                break;
-            }
-
-            // Sleep a short time before checking again
-            SDL_Delay(1);
-        }
-    }
+    // Pace the emulation to the duration of the frame's sample data
+    WaitFrame(nFrameLength);
 
     return true;
 }
@@ -153,18 +194,118 @@ void Audio::Silence ()
     if (!IsAvailable())
         return;
 
-    SDL_LockAudio();
-    memset(m_pbStart, 0x00, m_pbEnd-m_pbStart);
-    m_pbNow = m_pbEnd;
-    SDL_UnlockAudio();
+    // Ask the callback to discard anything still buffered
+    fDiscard = true;
+}
+
+// Fetch the number of times the buffer has run dry or been too full to accept data
+void Audio::GetStats (UINT &ruUnderruns_, UINT &ruOverruns_)
+{
+    ruUnderruns_ = uUnderruns;
+    ruOverruns_ = uOverruns;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Monotonic high-resolution time, in nanoseconds
+static int64_t GetNanoTime ()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Wait for the end of a frame with the given length of sample data.
+// With sound playing, small buffer level errors are corrected by resampling, but if the level
+// strays by more than a frame the period is also steered, to lock the emulation to the sound
+// device clock instead of drifting until the buffer runs dry or overflows.
+void WaitFrame (int nLength_)
+{
+    int64_t llPeriod = static_cast<int64_t>(nLength_ / SAMPLE_BLOCK) * 1000000000 / Sound::GetSampleFreq();
+
+    if (pbRing && Audio::IsAvailable())
+    {
+        // Smooth the fill error, as the callback removes data in large blocks
+        int nError = static_cast<int>(uHead - uTail) - static_cast<int>(uTargetFill);
+        nFillError += nError - (nFillError >> 4);
+
+        // Each frame of error outside the first adjusts the period by 0.5%, to lengthen it if we're ahead
+        int nExcess = nFillError >> 4;
+        nExcess -= std::max(-static_cast<int>(uFrameBytes), std::min(static_cast<int>(uFrameBytes), nExcess));
+        int64_t llAdjust = static_cast<int64_t>(nExcess) * 5000 / static_cast<int>(uFrameBytes);
+        llAdjust = std::max<int64_t>(-PACER_MAX_ADJUST, std::min<int64_t>(PACER_MAX_ADJUST, llAdjust));
+        llPeriod += llPeriod * llAdjust / 1000000;
+    }
+
+    int64_t llNow = GetNanoTime();
+
+    // If we're too far behind, re-sync
+    if (llNow - llNextFrame > llPeriod*2)
+        llNextFrame = llNow;
+
+    llNextFrame += llPeriod;
+
+    // Sleep until just before the deadline, then spin for the remainder
+    for (int64_t llRemain ; (llRemain = llNextFrame - GetNanoTime()) > 0 ; )
+    {
+        if (llRemain > PACER_SPIN_NS)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(llRemain - PACER_SPIN_NS));
+        else
+            std::this_thread::yield();
+    }
+}
+
+// Resample frame data by the given rate adjustment, using linear interpolation
+// The output is in pbResample, and its length is returned.
+int Resample (const Uint8 *pbData_, int nLength_, int nPpm_)
+{
+    int nSamples = nLength_ / SAMPLE_BLOCK;
+
+    // Allow for the largest output size at the maximum adjustment
+    int nMaxSize = (nSamples + nSamples/1000 + 2) * SAMPLE_BLOCK;
+    if (nMaxSize > nResampleSize)
+    {
+        delete[] pbResample;
+        pbResample = new Uint8[nResampleSize = nMaxSize];
+    }
+
+    // With no adjustment, snap to the nearest whole sample so the output is the unmodified input again
+    if (!nPpm_)
+        ullResamplePos = (ullResamplePos + (1ULL << 31)) & ~0xffffffffULL;
+
+    // Step through the input slightly faster for a positive adjustment, giving fewer output samples
+    uint64_t ullStep = (1ULL << 32) + static_cast<int64_t>(nPpm_) * 4295;
+    const short *psIn = reinterpret_cast<const short*>(pbData_);
+    short *psOut = reinterpret_cast<short*>(pbResample);
+    int nOut = 0;
+
+    // Position n interpolates between input samples n-1 and n, with the last sample of the previous frame before 0
+    for ( ; static_cast<int>(ullResamplePos >> 32) < nSamples ; ullResamplePos += ullStep, nOut++)
+    {
+        int n = static_cast<int>(ullResamplePos >> 32);
+        int nFrac = static_cast<int>((ullResamplePos >> 17) & 0x7fff);
+
+        for (int c = 0 ; c < SAMPLE_CHANNELS ; c++)
+        {
+            int nPrev = n ? psIn[(n-1)*SAMPLE_CHANNELS + c] : asLast[c];
+            int nNext = psIn[n*SAMPLE_CHANNELS + c];
+            *psOut++ = static_cast<short>(nPrev + (((nNext - nPrev) * nFrac) >> 15));
+        }
+    }
+
+    // Carry the position and last sample over to the next frame
+    if (nSamples)
+    {
+        ullResamplePos -= static_cast<uint64_t>(nSamples) << 32;
+        memcpy(asLast, psIn + (nSamples-1)*SAMPLE_CHANNELS, sizeof(asLast));
+    }
+
+    return nOut * SAMPLE_BLOCK;
+}
+
 bool InitSDLSound ()
 {
     SDL_AudioSpec sDesired = { };
-    sDesired.freq = SAMPLE_FREQ;
+    sDesired.freq = Sound::GetSampleFreq();
     sDesired.format = AUDIO_S16LSB;
     sDesired.channels = SAMPLE_CHANNELS;
     sDesired.samples = SAMPLE_BUFFER_SIZE;
@@ -183,23 +324,42 @@ bool InitSDLSound ()
 
 void ExitSDLSound ()
 {
+    // Stop the callback before releasing the buffer it reads from
     SDL_CloseAudio();
 
-    m_pbNow = m_pbStart = m_pbEnd = nullptr;
+    delete[] pbRing, pbRing = nullptr;
+    delete[] pbResample, pbResample = nullptr;
+    nResampleSize = 0;
 }
 
 // Callback used by SDL to request more sound data to play
 void SoundCallback (void * /*pvParam_*/, Uint8 *pbStream_, int nLen_)
 {
-    // Determine how much data we have available, how much to copy, and what is left over
-    int nData = static_cast<int>(m_pbNow - m_pbStart);
-    int nCopy = std::min(nData, nLen_), nLeft = nData-nCopy;
-
-    // Update the sound stream with what we have, padded with silence if we're short
-    memcpy(pbStream_, m_pbStart, nCopy);
-    memset(pbStream_+nCopy, 0x00, nLen_-nCopy);
+    // Only we move the tail, but new data may be added at any time
+    UINT uHeadNow = uHead.load(std::memory_order_acquire);
+    UINT uTailNow = uTail.load(std::memory_order_relaxed);
+
+    // Discard any buffered data if requested
+    if (fDiscard.exchange(false))
+        uTailNow = uHeadNow;
+
+    // Determine how much data we have available, and how much to copy
+    UINT uData = uHeadNow - uTailNow;
+    UINT uCopy = std::min(uData, static_cast<UINT>(nLen_));
+
+    // Copy what we have, in up to two parts if it wraps the end of the ring
+    UINT uOffset = uTailNow & uRingMask;
+    UINT uFirst = std::min(uCopy, uRingMask+1 - uOffset);
+    memcpy(pbStream_, pbRing + uOffset, uFirst);
+    memcpy(pbStream_ + uFirst, pbRing, uCopy - uFirst);
+
+    // Pad with silence if we're short
+    if (uCopy < static_cast<UINT>(nLen_))
+    {
+        memset(pbStream_+uCopy, 0x00, nLen_-uCopy);
+        uUnderruns++;
+    }
 
-    // Move any remaining data to the start of our buffer
-    m_pbNow = m_pbStart + nLeft;
-    memmove(m_pbStart, m_pbStart+nCopy, nLeft);
+    // Release the space we've used
+    uTail.store(uTailNow + uCopy, std::memory_order_release);
 }
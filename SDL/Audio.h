@@ -30,6 +30,7 @@ class Audio
         static bool IsAvailable () { return SDL_GetAudioStatus() == SDL_AUDIO_PLAYING; }
         static bool AddData (Uint8* pbData_, int nLength_);
         static void Silence ();
+        static void GetStats (UINT &ruUnderruns_, UINT &ruOverruns_);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -47,6 +47,7 @@
 #include <unistd.h>
 
 #define PATH_SEPARATOR      '/'
+#define O_BINARY            0       // No text/binary distinction
 
 typedef unsigned int        DWORD;  // must be 32-bit
 #ifndef __AMIGAOS4__
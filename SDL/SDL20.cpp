@@ -24,13 +24,189 @@
 #include "Frame.h"
 #include "GUI.h"
 #include "Options.h"
+#include "ThreadPool.h"
 #include "UI.h"
 
 #ifdef USE_SDL2
 
+#if (defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)) && SDL_VERSION_ATLEAST(2,0,4)
+#define SIMD_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef void (*FNCONVERTLINE)(DWORD *pdw_, const BYTE *pb_, int nWidth_, const DWORD *pdwPalette_);
+typedef void (*FNSCALELINE)(DWORD *pdw_, const DWORD *pdwSrc_, const int *pnMap_, int nWidth_);
+
 static DWORD aulPalette[N_PALETTE_COLOURS];
 static DWORD aulScanline[N_PALETTE_COLOURS];
 
+static FNCONVERTLINE pfnConvertLine16, pfnConvertLine32;
+static FNSCALELINE pfnScaleLine32;
+
+// Details of a software scaling job, shared by the worker threads
+typedef struct
+{
+    CScreen *pScreen;           // Source SAM screen
+    const bool *pafDirty;       // Source lines to redraw
+    bool fRedrawAll;            // Redraw all lines regardless of dirty flags?
+    int nSrcHeight;             // Source lines in use (halved outside the GUI)
+
+    DWORD *pdwTarget;           // Scaled 32-bit output image
+    int nWidth, nHeight;        // Output dimensions
+    int nFirstLine;             // First output line in the job
+    const int *pnXMap;          // Source pixel offset for each output pixel
+
+    bool fScanlines;            // Darken alternate lines?
+    int nScanHeight;            // Number of scanlines over the output height
+}
+SCALEJOB;
+
+
+// Convert a line of palettised SAM pixels to 16-bit native pixels, 8 at a time
+static void ConvertLine16 (DWORD *pdw_, const BYTE *pb_, int nWidth_, const DWORD *pdwPalette_)
+{
+    for (int x = nWidth_ >> 3 ; x > 0 ; x--)
+    {
+        pdw_[0] = SDL_SwapLE32((pdwPalette_[pb_[1]] << 16) | pdwPalette_[pb_[0]]);
+        pdw_[1] = SDL_SwapLE32((pdwPalette_[pb_[3]] << 16) | pdwPalette_[pb_[2]]);
+        pdw_[2] = SDL_SwapLE32((pdwPalette_[pb_[5]] << 16) | pdwPalette_[pb_[4]]);
+        pdw_[3] = SDL_SwapLE32((pdwPalette_[pb_[7]] << 16) | pdwPalette_[pb_[6]]);
+
+        pdw_ += 4;
+        pb_ += 8;
+    }
+}
+
+// Convert a line of palettised SAM pixels to 32-bit native pixels, 8 at a time
+static void ConvertLine32 (DWORD *pdw_, const BYTE *pb_, int nWidth_, const DWORD *pdwPalette_)
+{
+    for (int x = nWidth_ >> 3 ; x > 0 ; x--)
+    {
+        pdw_[0] = pdwPalette_[pb_[0]];
+        pdw_[1] = pdwPalette_[pb_[1]];
+        pdw_[2] = pdwPalette_[pb_[2]];
+        pdw_[3] = pdwPalette_[pb_[3]];
+        pdw_[4] = pdwPalette_[pb_[4]];
+        pdw_[5] = pdwPalette_[pb_[5]];
+        pdw_[6] = pdwPalette_[pb_[6]];
+        pdw_[7] = pdwPalette_[pb_[7]];
+
+        pdw_ += 8;
+        pb_ += 8;
+    }
+}
+
+// Stretch a line of native 32-bit pixels, using a source offset for each target pixel
+static void ScaleLine32 (DWORD *pdw_, const DWORD *pdwSrc_, const int *pnMap_, int nWidth_)
+{
+    for (int x = 0 ; x < nWidth_ ; x++)
+        pdw_[x] = pdwSrc_[pnMap_[x]];
+}
+
+#ifdef SIMD_AVX2
+
+// AVX2 version of ConvertLine16, gathering 16 palette entries and packing them to words
+TARGET_AVX2 static void ConvertLine16_AVX2 (DWORD *pdw_, const BYTE *pb_, int nWidth_, const DWORD *pdwPalette_)
+{
+    const int *pnPalette = reinterpret_cast<const int*>(pdwPalette_);
+
+    // Line widths are always a multiple of 16 pixels (see CScreen)
+    for (int x = nWidth_ >> 4 ; x > 0 ; x--)
+    {
+        __m128i i = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb_));
+        __m256i a = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(i), 4);
+        __m256i b = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(_mm_srli_si128(i, 8)), 4);
+
+        // Pack to 16-bit, then restore the pixel order that the per-lane pack interleaves
+        __m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), _MM_SHUFFLE(3,1,2,0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_), w);
+
+        pdw_ += 8;
+        pb_ += 16;
+    }
+}
+
+// AVX2 version of ConvertLine32, gathering 16 palette entries per iteration
+TARGET_AVX2 static void ConvertLine32_AVX2 (DWORD *pdw_, const BYTE *pb_, int nWidth_, const DWORD *pdwPalette_)
+{
+    const int *pnPalette = reinterpret_cast<const int*>(pdwPalette_);
+
+    for (int x = nWidth_ >> 4 ; x > 0 ; x--)
+    {
+        __m128i i = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb_));
+        __m256i a = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(i), 4);
+        __m256i b = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(_mm_srli_si128(i, 8)), 4);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_+8), b);
+
+        pdw_ += 16;
+        pb_ += 16;
+    }
+}
+
+// AVX2 version of ScaleLine32, gathering 8 target pixels at a time
+TARGET_AVX2 static void ScaleLine32_AVX2 (DWORD *pdw_, const DWORD *pdwSrc_, const int *pnMap_, int nWidth_)
+{
+    const int *pnSrc = reinterpret_cast<const int*>(pdwSrc_);
+    int x = 0;
+
+    for ( ; x+8 <= nWidth_ ; x += 8)
+    {
+        __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pnMap_+x));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_+x), _mm256_i32gather_epi32(pnSrc, i, 4));
+    }
+
+    // Finish any odd pixels at the end
+    ScaleLine32(pdw_+x, pdwSrc_, pnMap_+x, nWidth_-x);
+}
+
+#endif // SIMD_AVX2
+
+
+// Scale a band of output lines for a software scaling job
+static void ScaleBand (void *pvParam_, int nFrom_, int nTo_)
+{
+    const SCALEJOB *p = reinterpret_cast<const SCALEJOB*>(pvParam_);
+    DWORD adwLine[WIDTH_PIXELS*2];
+    DWORD *pdwLast = nullptr;
+    int nLastSrc = -1;
+    bool fLastScan = false;
+
+    for (int y = p->nFirstLine+nFrom_ ; y < p->nFirstLine+nTo_ ; y++)
+    {
+        int nSrc = y * p->nSrcHeight / p->nHeight;
+        DWORD *pdw = p->pdwTarget + y * p->nWidth;
+
+        // Skip lines that haven't changed
+        if (!p->fRedrawAll && !p->pafDirty[nSrc])
+            continue;
+
+        // Even scanlines are darkened, to match the hardware scanline overlay
+        bool fScan = p->fScanlines && !((y * p->nScanHeight / p->nHeight) & 1);
+
+        // Repeated source lines can be copied from the line above
+        if (pdwLast && nSrc == nLastSrc && fScan == fLastScan)
+            memcpy(pdw, pdwLast, p->nWidth * sizeof(DWORD));
+        else
+        {
+            // Convert the source line to native pixels, then stretch it to the output width
+            pfnConvertLine32(adwLine, p->pScreen->GetLine(nSrc), p->pScreen->GetPitch(), fScan ? aulScanline : aulPalette);
+            pfnScaleLine32(pdw, adwLine, p->pnXMap, p->nWidth);
+        }
+
+        pdwLast = pdw;
+        nLastSrc = nSrc;
+        fLastScan = fScan;
+    }
+}
+
 
 SDLTexture::SDLTexture ()
     : m_fFilter(GetOption(filter))
@@ -44,6 +220,20 @@ SDLTexture::SDLTexture ()
 #ifdef SDL_VIDEO_FULLSCREEN_SPACES
     SDL_SetHint(SDL_VIDEO_FULLSCREEN_SPACES, "1");
 #endif
+
+    // Use the fastest pixel conversion the CPU supports
+    pfnConvertLine16 = ConvertLine16;
+    pfnConvertLine32 = ConvertLine32;
+    pfnScaleLine32 = ScaleLine32;
+#ifdef SIMD_AVX2
+    if (SDL_HasAVX2())
+    {
+        TRACE("Using AVX2 pixel conversion\n");
+        pfnConvertLine16 = ConvertLine16_AVX2;
+        pfnConvertLine32 = ConvertLine32_AVX2;
+        pfnScaleLine32 = ScaleLine32_AVX2;
+    }
+#endif
 }
 
 SDLTexture::~SDLTexture ()
@@ -52,12 +242,17 @@ SDLTexture::~SDLTexture ()
     if (m_pTexture) SDL_DestroyTexture(m_pTexture), m_pTexture = nullptr;
     if (m_pRenderer) SDL_DestroyRenderer(m_pRenderer), m_pRenderer = nullptr;
     if (m_pWindow) SDL_DestroyWindow(m_pWindow), m_pWindow = nullptr;
+
+    delete m_pThreadPool, m_pThreadPool = nullptr;
+    delete[] m_pdwScaled, m_pdwScaled = nullptr;
+    delete[] m_pnXMap, m_pnXMap = nullptr;
 }
 
 
 int SDLTexture::GetCaps () const
 {
-    return VCAP_STRETCH | VCAP_FILTER | VCAP_SCANHIRES;
+    // Software scaling doesn't support filtering
+    return m_fSoftScale ? (VCAP_STRETCH | VCAP_SCANHIRES) : (VCAP_STRETCH | VCAP_FILTER | VCAP_SCANHIRES);
 }
 
 bool SDLTexture::Init (bool fFirstInit_)
@@ -86,24 +281,36 @@ bool SDLTexture::Init (bool fFirstInit_)
     // Limit window to 50% size (typically 384x240)
     SDL_SetWindowMinimumSize(m_pWindow, nWidth/2, nHeight/2);
 
-    m_pRenderer = SDL_CreateRenderer(m_pWindow, -1, SDL_RENDERER_ACCELERATED);
-    if (!m_pRenderer)
+    if (GetOption(hwaccel))
+        m_pRenderer = SDL_CreateRenderer(m_pWindow, -1, SDL_RENDERER_ACCELERATED);
+
+    if (m_pRenderer)
     {
-        TRACE("Failed to create SDL2 renderer!\n");
-        SDL_DestroyWindow(m_pWindow), m_pWindow = nullptr;
-        return false;
-    }
+        SDL_RendererInfo ri;
+        SDL_GetRendererInfo(m_pRenderer, &ri);
 
-    SDL_RendererInfo ri;
-    SDL_GetRendererInfo(m_pRenderer, &ri);
+        // Ensure the renderer is accelerated
+        if (!(ri.flags & SDL_RENDERER_ACCELERATED))
+        {
+            TRACE("SDLTexture: skipping non-accelerated renderer\n");
+            SDL_DestroyRenderer(m_pRenderer), m_pRenderer = nullptr;
+        }
+    }
 
-    // Ensure the renderer is accelerated
-    if (!(ri.flags & SDL_RENDERER_ACCELERATED))
+    // Without acceleration we'll do our own scaling, and use the renderer only for a 1:1 copy
+    if (!m_pRenderer)
     {
-        TRACE("SDLTexture: skipping non-accelerated renderer\n");
-        SDL_DestroyRenderer(m_pRenderer), m_pRenderer = nullptr;
-        SDL_DestroyWindow(m_pWindow), m_pWindow = nullptr;
-        return false;
+        m_pRenderer = SDL_CreateRenderer(m_pWindow, -1, SDL_RENDERER_SOFTWARE);
+        if (!m_pRenderer)
+        {
+            TRACE("Failed to create SDL2 renderer!\n");
+            SDL_DestroyWindow(m_pWindow), m_pWindow = nullptr;
+            return false;
+        }
+
+        TRACE("SDLTexture: using software scaling\n");
+        m_fSoftScale = true;
+        m_pThreadPool = new CThreadPool;
     }
 
     UpdateSize();
@@ -155,6 +362,9 @@ void SDLTexture::UpdatePalette ()
 // OpenGL version of DisplayChanges
 bool SDLTexture::DrawChanges (CScreen* pScreen_, bool *pafDirty_)
 {
+    if (m_fSoftScale)
+        return DrawScaled(pScreen_, pafDirty_);
+
     // Force GUI filtering with odd scaling factors, otherwise respect the options
     bool fFilter = GUI::IsActive() ? GetOption(filtergui) || (GetOption(scale) & 1) : GetOption(filter);
 
@@ -200,74 +410,145 @@ bool SDLTexture::DrawChanges (CScreen* pScreen_, bool *pafDirty_)
         return false;
     }
 
-    int nRightHi = nWidth >> 3;
-
-    DWORD *pdwBack = reinterpret_cast<DWORD*>(pvPixels), *pdw = pdwBack;
+    DWORD *pdwBack = reinterpret_cast<DWORD*>(pvPixels);
     long lPitchDW = nPitch >> 2;
 
-    BYTE *pbSAM = pScreen_->GetLine(nChangeFrom), *pb = pbSAM;
+    BYTE *pbSAM = pScreen_->GetLine(nChangeFrom);
     long lPitch = pScreen_->GetPitch();
 
+    // Select the converter for the colour depth of the target surface
+    FNCONVERTLINE pfnConvertLine = (m_nDepth == 16) ? pfnConvertLine16 :
+                                   (m_nDepth == 32) ? pfnConvertLine32 : nullptr;
 
-    // What colour depth is the target surface?
-    switch (m_nDepth)
+    if (pfnConvertLine)
     {
-        case 16:
-        {
-            for (int y = nChangeFrom ; y <= nChangeTo ; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
-            {
-                if (!pafDirty_[y])
-                    continue;
-
-                for (int x = 0 ; x < nRightHi ; x++)
-                {
-                    pdw[0] = SDL_SwapLE32((aulPalette[pb[1]] << 16) | aulPalette[pb[0]]);
-                    pdw[1] = SDL_SwapLE32((aulPalette[pb[3]] << 16) | aulPalette[pb[2]]);
-                    pdw[2] = SDL_SwapLE32((aulPalette[pb[5]] << 16) | aulPalette[pb[4]]);
-                    pdw[3] = SDL_SwapLE32((aulPalette[pb[7]] << 16) | aulPalette[pb[6]]);
-
-                    pdw += 4;
-                    pb += 8;
-                }
-            }
-        }
-        break;
-
-        case 32:
+        for (int y = nChangeFrom ; y <= nChangeTo ; pdwBack += lPitchDW, pbSAM += lPitch, y++)
         {
-            for (int y = nChangeFrom ; y <= nChangeTo ; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
-            {
-                if (!pafDirty_[y])
-                    continue;
-
-                for (int x = 0 ; x < nRightHi ; x++)
-                {
-                    pdw[0] = aulPalette[pb[0]];
-                    pdw[1] = aulPalette[pb[1]];
-                    pdw[2] = aulPalette[pb[2]];
-                    pdw[3] = aulPalette[pb[3]];
-                    pdw[4] = aulPalette[pb[4]];
-                    pdw[5] = aulPalette[pb[5]];
-                    pdw[6] = aulPalette[pb[6]];
-                    pdw[7] = aulPalette[pb[7]];
-
-                    pdw += 8;
-                    pb += 8;
-                }
-            }
+            if (pafDirty_[y])
+                pfnConvertLine(pdwBack, pbSAM, nWidth, aulPalette);
         }
-        break;
     }
 
     // Unlock the texture now we're done drawing on it
     SDL_UnlockTexture(m_pTexture);
 
     SDL_Rect rTexture = { 0,0, nWidth, nHeight };
+
+    UpdateTarget();
+    SDL_Rect rWindow = m_rTarget;
+
+    SDL_RenderClear(m_pRenderer);
+    SDL_RenderCopy(m_pRenderer, m_pTexture, &rTexture, &rWindow);
+
+    if (m_pScanlineTexture && GetOption(scanlines) && !GUI::IsActive())
+    {
+        SDL_Rect rScanlines = { 0, 0, 1, GetOption(scanhires) ? rWindow.h : Frame::GetHeight() };
+
+        SDL_SetTextureBlendMode(m_pScanlineTexture, SDL_BLENDMODE_BLEND);
+        SDL_RenderCopy(m_pRenderer, m_pScanlineTexture, &rScanlines, &rWindow);
+    }
+
+    SDL_RenderPresent(m_pRenderer);
+
+    return true;
+}
+
+// Software scaled version of DrawChanges, for displays without acceleration
+bool SDLTexture::DrawScaled (CScreen* pScreen_, bool *pafDirty_)
+{
+    int nSrcHeight = Frame::GetHeight() >> (GUI::IsActive() ? 0 : 1);
+    bool fRedrawAll = nSrcHeight != m_nScaledSrcHeight;
+
+    // Recreate the texture if the output size has changed
+    UpdateTarget();
+    if (!m_pTexture || m_rTarget.w != m_nScaledWidth || m_rTarget.h != m_nScaledHeight)
+    {
+        if (!CreateScaledTexture())
+            return false;
+
+        fRedrawAll = true;
+    }
+
+    int nChangeFrom = 0, nChangeTo = nSrcHeight-1;
+    if (!fRedrawAll)
+    {
+        for ( ; nChangeFrom < nSrcHeight && !pafDirty_[nChangeFrom] ; nChangeFrom++);
+        for ( ; nChangeTo > nChangeFrom && !pafDirty_[nChangeTo] ; nChangeTo--);
+    }
+
+    if (nChangeFrom < nSrcHeight)
+    {
+        // Determine the output lines covered by the changed source lines
+        int nFrom = (nChangeFrom * m_nScaledHeight + nSrcHeight-1) / nSrcHeight;
+        int nTo = ((nChangeTo+1) * m_nScaledHeight + nSrcHeight-1) / nSrcHeight;
+
+        SCALEJOB job = { };
+        job.pScreen = pScreen_;
+        job.pafDirty = pafDirty_;
+        job.fRedrawAll = fRedrawAll;
+        job.nSrcHeight = nSrcHeight;
+        job.pdwTarget = m_pdwScaled;
+        job.nWidth = m_nScaledWidth;
+        job.nHeight = m_nScaledHeight;
+        job.nFirstLine = nFrom;
+        job.pnXMap = m_pnXMap;
+        job.fScanlines = GetOption(scanlines) && !GUI::IsActive();
+        job.nScanHeight = GetOption(scanhires) ? m_nScaledHeight : Frame::GetHeight();
+
+        // Scale the changed lines in bands across the worker threads
+        m_pThreadPool->Run(ScaleBand, &job, nTo-nFrom);
+
+        SDL_Rect rUpdate = { 0, nFrom, m_nScaledWidth, nTo-nFrom };
+        SDL_UpdateTexture(m_pTexture, &rUpdate, m_pdwScaled + nFrom*m_nScaledWidth, m_nScaledWidth * sizeof(DWORD));
+
+        // Clear the dirty flags for the changed block
+        for (int i = nChangeFrom ; i <= nChangeTo ; pafDirty_[i++] = false);
+    }
+
+    m_nScaledSrcHeight = nSrcHeight;
+
+    SDL_RenderClear(m_pRenderer);
+    SDL_RenderCopy(m_pRenderer, m_pTexture, nullptr, &m_rTarget);
+    SDL_RenderPresent(m_pRenderer);
+
+    return true;
+}
+
+// Create the output texture and scaling tables for the current display area
+bool SDLTexture::CreateScaledTexture ()
+{
+    if (m_pTexture) SDL_DestroyTexture(m_pTexture), m_pTexture = nullptr;
+    delete[] m_pdwScaled, m_pdwScaled = nullptr;
+    delete[] m_pnXMap, m_pnXMap = nullptr;
+
+    m_nScaledWidth = std::max(m_rTarget.w, 1);
+    m_nScaledHeight = std::max(m_rTarget.h, 1);
+
+    m_pTexture = SDL_CreateTexture(m_pRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, m_nScaledWidth, m_nScaledHeight);
+    if (!m_pTexture)
+    {
+        TRACE("!!! SDL_CreateTexture failed: %s\n", SDL_GetError());
+        return false;
+    }
+
+    m_pdwScaled = new DWORD[m_nScaledWidth * m_nScaledHeight];
+    m_pnXMap = new int[m_nScaledWidth];
+
+    // Map each output pixel to its source pixel, which also takes care of the 5:4 stretch
+    for (int x = 0, nWidth = Frame::GetWidth() ; x < m_nScaledWidth ; x++)
+        m_pnXMap[x] = x * nWidth / m_nScaledWidth;
+
+    return true;
+}
+
+// Determine the display area within the window, preserving the aspect ratio
+void SDLTexture::UpdateTarget ()
+{
     SDL_Rect rWindow = { 0,0, 0,0 };
     SDL_GetWindowSize(m_pWindow, &rWindow.w, &rWindow.h);
 
-    nWidth = Frame::GetWidth();
-    nHeight = Frame::GetHeight();
+    int nWidth = Frame::GetWidth();
+    int nHeight = Frame::GetHeight();
     if (GetOption(ratio5_4)) nWidth = nWidth * 5/4;
 
     int nWidthFit = nWidth * rWindow.h / nHeight;
@@ -289,21 +570,6 @@ bool SDLTexture::DrawChanges (CScreen* pScreen_, bool *pafDirty_)
     rWindow.w = nWidth;
     rWindow.h = nHeight;
     m_rTarget = rWindow;
-
-    SDL_RenderClear(m_pRenderer);
-    SDL_RenderCopy(m_pRenderer, m_pTexture, &rTexture, &rWindow);
-
-    if (m_pScanlineTexture && GetOption(scanlines) && !GUI::IsActive())
-    {
-        SDL_Rect rScanlines = { 0, 0, 1, GetOption(scanhires) ? rWindow.h : Frame::GetHeight() };
-
-        SDL_SetTextureBlendMode(m_pScanlineTexture, SDL_BLENDMODE_BLEND);
-        SDL_RenderCopy(m_pRenderer, m_pScanlineTexture, &rScanlines, &rWindow);
-    }
-
-    SDL_RenderPresent(m_pRenderer);
-
-    return true;
 }
 
 void SDLTexture::UpdateSize ()
@@ -316,6 +582,15 @@ void SDLTexture::UpdateSize ()
     if (m_pScanlineTexture) SDL_DestroyTexture(m_pScanlineTexture), m_pScanlineTexture = nullptr;
     if (m_pTexture) SDL_DestroyTexture(m_pTexture), m_pTexture = nullptr;
 
+    // Software scaling creates its texture at the output size, and draws its own scanlines
+    if (m_fSoftScale)
+    {
+        UpdateTarget();
+        CreateScaledTexture();
+        Video::SetDirty();
+        return;
+    }
+
     int nWidth = Frame::GetWidth();
     int nHeight = Frame::GetHeight();
 
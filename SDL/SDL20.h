@@ -25,6 +25,8 @@
 
 #include "Video.h"
 
+class CThreadPool;
+
 class SDLTexture final : public VideoBase
 {
     public:
@@ -46,6 +48,9 @@ class SDLTexture final : public VideoBase
 
     protected:
         bool DrawChanges (CScreen* pScreen_, bool *pafDirty_);
+        bool DrawScaled (CScreen* pScreen_, bool *pafDirty_);
+        bool CreateScaledTexture ();
+        void UpdateTarget ();
 
     private:
         SDL_Window *m_pWindow = nullptr;
@@ -57,6 +62,12 @@ class SDLTexture final : public VideoBase
         bool m_fFilter = false;
 
         SDL_Rect m_rTarget {};
+
+        bool m_fSoftScale = false;              // Scaling in software rather than by the renderer?
+        CThreadPool *m_pThreadPool = nullptr;   // Workers for software scaling
+        DWORD *m_pdwScaled = nullptr;           // Scaled output image
+        int *m_pnXMap = nullptr;                // Source pixel for each output pixel
+        int m_nScaledWidth = 0, m_nScaledHeight = 0, m_nScaledSrcHeight = 0;
 };
 
 #endif // USE_SDL2
@@ -212,13 +212,13 @@ static bool InitDirectSound ()
         // Set up the sound format according to the sound options
         WAVEFORMATEX wf = {};
         wf.wFormatTag = WAVE_FORMAT_PCM;
-        wf.nSamplesPerSec = SAMPLE_FREQ;
+        wf.nSamplesPerSec = Sound::GetSampleFreq();
         wf.wBitsPerSample = SAMPLE_BITS;
         wf.nChannels = SAMPLE_CHANNELS;
         wf.nBlockAlign = SAMPLE_BLOCK;
-        wf.nAvgBytesPerSec = SAMPLE_FREQ * SAMPLE_BLOCK;
+        wf.nAvgBytesPerSec = Sound::GetSampleFreq() * SAMPLE_BLOCK;
 
-        int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND)+1;
+        int nSamplesPerFrame = (Sound::GetSampleFreq() / EMULATED_FRAMES_PER_SECOND)+1;
         nSampleBufferSize = nSamplesPerFrame*SAMPLE_BLOCK * (1+GetOption(latency));
 
         DSBUFFERDESC dsbd = { sizeof(DSBUFFERDESC) };
@@ -29,6 +29,9 @@ class Audio
 
         static void Silence ();
         static bool AddData (BYTE *pb_, int nLen_);
+
+        // DirectSound manages its own buffer, so there are no underrun/overrun counts
+        static void GetStats (UINT &ruUnderruns_, UINT &ruOverruns_) { ruUnderruns_ = ruOverruns_ = 0; }
 };
 
 #endif  // AUDIO_H